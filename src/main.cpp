@@ -2,12 +2,15 @@
 #include "util/parser.h"
 #include "renderer/renderer.h"
 #include "renderer/config.h"
+#include "renderer/aov.h"
 #include "scene/scene.h"
 #include "util/parser.h"
 #include "util/jlm.h"
+#include "scene/cie.h"
 
 #define VIDEO false
 #define VSTART 0
+#define VSTEP 1.2f // degrees the scene turns between frames
 
 void rotatescene(Scene& scene, float r) {
 	for (int i = 0; i < scene.primitives.size(); i++) {
@@ -21,7 +24,89 @@ void rotatescene(Scene& scene, float r) {
 	}
 }
 
+Spectrum parseWeight(std::string arg) {
+	// either a plain scale, or comma separated spectral values spread across the full range
+	std::vector<float> values;
+	size_t start = 0;
+	while (start <= arg.size()) {
+		size_t end = arg.find(',', start);
+		if (end == std::string::npos) end = arg.size();
+		values.push_back(std::stof(arg.substr(start, end - start)));
+		start = end + 1;
+	}
+	if (values.size() == 1) return Spectrum(values[0]);
+	return Spectrum(Fourier(values, NMSTART, NMEND));
+}
+
+int relight(int argc, char *argv[]) {
+	if (argc < 4) {
+        FATAL("Wrong number of input arguments detected - correct format:\n\t  program.exe relight <aov_path> <output_path> <weights...>");
+	}
+	CIE::init();
+	AOVBuffer buffer;
+	if (!AOVUtils::load(buffer, std::string(argv[2]))) return 1;
+	std::vector<Spectrum> weights;
+	for (int i = 4; i < argc; i++) weights.push_back(parseWeight(std::string(argv[i])));
+	for (int i = 0; i < buffer.count; i++) INFO("Channel %d (%s): %s", i, buffer.names[i].c_str(), i < weights.size() ? argv[i + 4] : "1");
+	long long start = TIME();
+	Image image = AOVUtils::recombine(buffer, weights);
+	INFO("Recombined %d channels in %.3f seconds", (int)buffer.count, (float)(TIME() - start) / 1000.0f);
+	if (!image.save(std::string(argv[3]))) {
+		ERROR("Unable to save image");
+		return 1;
+	}
+	return 0;
+}
+
+float imageError(const Image& a, const Image& b, float& largest) {
+	// root mean square over every channel
+	double squared = 0.0;
+	largest = 0.0f;
+	for (size_t i = 0; i < a.colors.size(); i++) {
+		glm::vec3 d = glm::abs(a.colors[i] - b.colors[i]);
+		squared += glm::dot(d, d) / 3.0f;
+		largest = std::max(largest, std::max(d.x, std::max(d.y, d.z)));
+	}
+	return std::sqrt(squared / a.colors.size());
+}
+
+int compare(int argc, char *argv[]) {
+	// renders the scene with precise and with fast math, from the same samples, and once more
+	// precisely from another seed. that last difference is the noise floor: once a sample takes
+	// another branch its path diverges, so any error near the floor is noise rather than bias
+	if (argc != 7) {
+        FATAL("Wrong number of input arguments detected - correct format:\n\t  program.exe compare <input_path> <output_path> <samples> <width> <height>");
+	}
+	GlobalConfig::pathSamples(std::stoi(std::string(argv[4])));
+	int w = std::stoi(std::string(argv[5]));
+	int h = std::stoi(std::string(argv[6]));
+	Renderer renderer;
+	Scene scene = Parser::parse(std::string(argv[2]));
+	GlobalConfig::fastMath(false);
+	Image precise = renderer.render(scene, w, h);
+	GlobalConfig::fastMath(true);
+	Image fast = renderer.render(scene, w, h);
+	GlobalConfig::fastMath(false);
+	GlobalConfig::seed(GlobalConfig::seed() + 1);
+	Image reseeded = renderer.render(scene, w, h);
+	GlobalConfig::seed(GlobalConfig::seed() - 1);
+	float largest, floorLargest;
+	float error = imageError(fast, precise, largest);
+	float noise = imageError(reseeded, precise, floorLargest);
+	float preciseTime = precise.time - precise.prepare - precise.post;
+	float fastTime = fast.time - fast.prepare - fast.post;
+	INFO("Rendering: precise %.3f seconds, fast math %.3f seconds, %.2fx speedup", preciseTime, fastTime, preciseTime / fastTime);
+	INFO("Image error: rmse %.5f, largest %.5f\n\t  Noise floor: rmse %.5f, largest %.5f", error, largest, noise, floorLargest);
+	if (!fast.save(std::string(argv[3]))) {
+		ERROR("Unable to save image");
+		return 1;
+	}
+	return 0;
+}
+
 int main (int argc, char *argv[]) {
+	if (argc > 1 && std::string(argv[1]) == "relight") return relight(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "compare") return compare(argc, argv);
 	if (argc != 6) {
         FATAL("Wrong number of input arguments detected - correct format:\n\t  program.exe <input_path> <output_path> <samples> <width> <height>");
 	}
@@ -32,7 +117,7 @@ int main (int argc, char *argv[]) {
 	Scene scene = Parser::parse(std::string(argv[1]));
     INFO("Rendering scene...");
     if (!VIDEO) {
-        Image image = renderer.render(scene, std::stoi(std::string(argv[4])), std::stoi(std::string(argv[5])));
+        Image image = renderer.render(scene, std::stoi(std::string(argv[4])), std::stoi(std::string(argv[5])), std::string(argv[2]));
         INFO("Finished rendering in %.3f seconds!", image.time);
         INFO("Time breakdown:\n\t  Preprocessing: %.3f seconds\n\t  Rendering: %.3f seconds\n\t  PostProcessing: %.3f seconds", image.prepare, image.time - image.prepare - image.post, image.post);
         INFO("Saving image...");
@@ -41,14 +126,20 @@ int main (int argc, char *argv[]) {
         } else {
             ERROR("Unable to save image");
         }
+        if (GlobalConfig::lightAOVs() && renderer.saveAOVs(std::string(argv[2]))) INFO("Saved light AOVs to %s.aov", argv[2]);
+        if (GlobalConfig::adaptive() && renderer.saveSampleMap(std::string(argv[2]))) INFO("Saved sample map to %s.spp.png", argv[2]);
     } else {
+        int seed = GlobalConfig::seed();
         for (int i = 0; i < 300; i++) {
             if (i >= VSTART) {
+                // accumulated frames need samples of their own, or the history only repeats them
+                if (GlobalConfig::temporal()) GlobalConfig::seed(seed + i);
 		        Image image = renderer.render(scene, std::stoi(std::string(argv[4])), std::stoi(std::string(argv[5])));
 		        INFO("Finished rendering image %d in %.3f seconds!", i, image.time);
 		        image.save("videos/raws/i_" + std::to_string(i) + ".png");
             }
-		    rotatescene(scene, glm::radians(1.2f));
+		    rotatescene(scene, glm::radians(VSTEP));
+		    renderer.reproject(jlm::rotate(glm::mat4(1.0f), glm::radians(VSTEP), glm::vec3(0, 1.0f, 0.0f)));
 	    }
     }
     return 0;
@@ -0,0 +1,90 @@
+#include "aov.h"
+#include "util/log.h"
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+
+#define AOV_MAGIC "CAOV"
+
+AOVBuffer AOVUtils::generateBuffer(size_t w, size_t h, const Scene& scene) {
+	AOVBuffer buffer{};
+	buffer.w = w;
+	buffer.h = h;
+	buffer.count = scene.aovCount();
+	for (int i = 0; i < buffer.count; i++) buffer.names.push_back(scene.aovName(i));
+	buffer.channels.assign(w*h*buffer.count, Spectrum(0.0f));
+	return buffer;
+}
+
+bool AOVUtils::save(const AOVBuffer& buffer, std::string filepath) {
+	std::ofstream outFile = std::ofstream(filepath, std::ios::binary);
+	if (!outFile) {
+		WARN("Unable to save light AOV file");
+		return false;
+	}
+	uint32_t header[4] = { (uint32_t)buffer.w, (uint32_t)buffer.h, (uint32_t)buffer.count, NMSAMPLES };
+	outFile.write(AOV_MAGIC, 4);
+	outFile.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (const auto& name : buffer.names) {
+		uint32_t len = name.size();
+		outFile.write(reinterpret_cast<const char*>(&len), sizeof(len));
+		outFile.write(name.data(), len);
+	}
+	outFile.write(reinterpret_cast<const char*>(buffer.channels.data()), buffer.channels.size() * sizeof(Spectrum));
+	outFile.close();
+	return true;
+}
+
+bool AOVUtils::load(AOVBuffer& buffer, std::string filepath) {
+	std::ifstream inFile = std::ifstream(filepath, std::ios::binary);
+	if (!inFile) {
+		WARN("Unable to open light AOV file \"%s\"", filepath.c_str());
+		return false;
+	}
+	char magic[4];
+	uint32_t header[4];
+	inFile.read(magic, 4);
+	inFile.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!inFile || memcmp(magic, AOV_MAGIC, 4) != 0) {
+		WARN("\"%s\" is not a light AOV file", filepath.c_str());
+		return false;
+	}
+	if (header[3] != NMSAMPLES) {
+		WARN("Light AOV file was rendered with %d wavelength samples, expected %d", (int)header[3], NMSAMPLES);
+		return false;
+	}
+	buffer.w = header[0];
+	buffer.h = header[1];
+	buffer.count = header[2];
+	buffer.names.clear();
+	for (int i = 0; i < buffer.count; i++) {
+		uint32_t len = 0;
+		inFile.read(reinterpret_cast<char*>(&len), sizeof(len));
+		std::string name(len, '\0');
+		inFile.read(&name[0], len);
+		buffer.names.push_back(name);
+	}
+	buffer.channels.resize(buffer.w*buffer.h*buffer.count);
+	inFile.read(reinterpret_cast<char*>(buffer.channels.data()), buffer.channels.size() * sizeof(Spectrum));
+	if (!inFile) {
+		WARN("Light AOV file \"%s\" is truncated", filepath.c_str());
+		return false;
+	}
+	return true;
+}
+
+Image AOVUtils::recombine(const AOVBuffer& buffer, const std::vector<Spectrum>& weights) {
+	Image img{};
+	img.w = buffer.w;
+	img.h = buffer.h;
+	img.colors.assign(buffer.w*buffer.h, glm::vec3(0));
+	for (size_t i = 0; i < buffer.w*buffer.h; i++) {
+		Spectrum s = Spectrum(0.0f);
+		for (size_t c = 0; c < buffer.count; c++) {
+			const Spectrum& channel = buffer.channels[i*buffer.count + c];
+			s += c < weights.size() ? channel * weights[c] : channel;
+		}
+		img.colors[i] = s.rgb();
+	}
+	return img;
+}
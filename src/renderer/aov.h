@@ -0,0 +1,20 @@
+#pragma once
+
+#include "scene/scene.h"
+#include "renderer/image.h"
+#include <string>
+
+struct AOVBuffer {
+	std::vector<Spectrum> channels; // pixel-major, count spectra per pixel
+	std::vector<std::string> names;
+	size_t w = 0;
+	size_t h = 0;
+	size_t count = 0;
+};
+
+namespace AOVUtils {
+	AOVBuffer generateBuffer(size_t w, size_t h, const Scene& scene);
+	bool save(const AOVBuffer& buffer, std::string filepath);
+	bool load(AOVBuffer& buffer, std::string filepath);
+	Image recombine(const AOVBuffer& buffer, const std::vector<Spectrum>& weights);
+};
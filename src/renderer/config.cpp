@@ -26,6 +26,122 @@ int GlobalConfig::pppasses() {
 	return g_config.pppasses;
 }
 
+bool GlobalConfig::lightAOVs() {
+	return g_config.lightaovs;
+}
+
+int GlobalConfig::threads() {
+	return g_config.threads;
+}
+
+int GlobalConfig::seed() {
+	return g_config.seed;
+}
+
+bool GlobalConfig::adaptive() {
+	return g_config.adaptive;
+}
+
+float GlobalConfig::adaptiveError() {
+	return g_config.adaptiveerror;
+}
+
+int GlobalConfig::adaptiveMax() {
+	return g_config.adaptivemax;
+}
+
+bool GlobalConfig::emitterSampling() {
+	return g_config.emittersampling;
+}
+
+bool GlobalConfig::restir() {
+	return g_config.restir;
+}
+
+bool GlobalConfig::guiding() {
+	return g_config.guiding;
+}
+
+int GlobalConfig::guidingPasses() {
+	return g_config.guidingpasses;
+}
+
+bool GlobalConfig::photons() {
+	return g_config.photons;
+}
+
+int GlobalConfig::photonPasses() {
+	return g_config.photonpasses;
+}
+
+int GlobalConfig::photonCount() {
+	return g_config.photoncount;
+}
+
+float GlobalConfig::photonRadius() {
+	return g_config.photonradius;
+}
+
+bool GlobalConfig::mlt() {
+	return g_config.mlt;
+}
+
+int GlobalConfig::mltBootstrap() {
+	return g_config.mltbootstrap;
+}
+
+int GlobalConfig::mltChains() {
+	return g_config.mltchains;
+}
+
+float GlobalConfig::mltLargeStep() {
+	return g_config.mltlargestep;
+}
+
+float GlobalConfig::mltSigma() {
+	return g_config.mltsigma;
+}
+
+bool GlobalConfig::bdpt() {
+	return g_config.bdpt;
+}
+
+bool GlobalConfig::cache() {
+	return g_config.cache;
+}
+
+int GlobalConfig::cachePasses() {
+	return g_config.cachepasses;
+}
+
+float GlobalConfig::cacheCell() {
+	return g_config.cachecell;
+}
+
+bool GlobalConfig::wavefront() {
+	return g_config.wavefront;
+}
+
+int GlobalConfig::rayBudget() {
+	return g_config.raybudget;
+}
+
+bool GlobalConfig::fastMath() {
+	return g_config.fastmath;
+}
+
+bool GlobalConfig::temporal() {
+	return g_config.temporal;
+}
+
+bool GlobalConfig::preview() {
+	return g_config.preview;
+}
+
+int GlobalConfig::previewSamples() {
+	return g_config.previewsamples;
+}
+
 void GlobalConfig::minDepth(int i) {
 	g_config.mindepth = i;
 }
@@ -49,3 +165,119 @@ void GlobalConfig::denoise(bool b) {
 void GlobalConfig::pppasses(int i) {
 	g_config.pppasses = i;
 }
+
+void GlobalConfig::lightAOVs(bool b) {
+	g_config.lightaovs = b;
+}
+
+void GlobalConfig::threads(int i) {
+	g_config.threads = i;
+}
+
+void GlobalConfig::seed(int i) {
+	g_config.seed = i;
+}
+
+void GlobalConfig::adaptive(bool b) {
+	g_config.adaptive = b;
+}
+
+void GlobalConfig::adaptiveError(float f) {
+	g_config.adaptiveerror = f;
+}
+
+void GlobalConfig::adaptiveMax(int i) {
+	g_config.adaptivemax = i;
+}
+
+void GlobalConfig::emitterSampling(bool b) {
+	g_config.emittersampling = b;
+}
+
+void GlobalConfig::restir(bool b) {
+	g_config.restir = b;
+}
+
+void GlobalConfig::guiding(bool b) {
+	g_config.guiding = b;
+}
+
+void GlobalConfig::guidingPasses(int i) {
+	g_config.guidingpasses = i;
+}
+
+void GlobalConfig::photons(bool b) {
+	g_config.photons = b;
+}
+
+void GlobalConfig::photonPasses(int i) {
+	g_config.photonpasses = i;
+}
+
+void GlobalConfig::photonCount(int i) {
+	g_config.photoncount = i;
+}
+
+void GlobalConfig::photonRadius(float f) {
+	g_config.photonradius = f;
+}
+
+void GlobalConfig::mlt(bool b) {
+	g_config.mlt = b;
+}
+
+void GlobalConfig::mltBootstrap(int i) {
+	g_config.mltbootstrap = i;
+}
+
+void GlobalConfig::mltChains(int i) {
+	g_config.mltchains = i;
+}
+
+void GlobalConfig::mltLargeStep(float f) {
+	g_config.mltlargestep = f;
+}
+
+void GlobalConfig::mltSigma(float f) {
+	g_config.mltsigma = f;
+}
+
+void GlobalConfig::bdpt(bool b) {
+	g_config.bdpt = b;
+}
+
+void GlobalConfig::cache(bool b) {
+	g_config.cache = b;
+}
+
+void GlobalConfig::cachePasses(int i) {
+	g_config.cachepasses = i;
+}
+
+void GlobalConfig::cacheCell(float f) {
+	g_config.cachecell = f;
+}
+
+void GlobalConfig::wavefront(bool b) {
+	g_config.wavefront = b;
+}
+
+void GlobalConfig::rayBudget(int i) {
+	g_config.raybudget = i;
+}
+
+void GlobalConfig::fastMath(bool b) {
+	g_config.fastmath = b;
+}
+
+void GlobalConfig::temporal(bool b) {
+	g_config.temporal = b;
+}
+
+void GlobalConfig::preview(bool b) {
+	g_config.preview = b;
+}
+
+void GlobalConfig::previewSamples(int i) {
+	g_config.previewsamples = i;
+}
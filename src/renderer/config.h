@@ -7,6 +7,35 @@ struct Config {
 	bool pathtrace = true;
 	bool denoise = true;
 	int pppasses = 2;
+	bool lightaovs = false;
+	int threads = 0; // 0 uses every core
+	int seed = 0;
+	bool adaptive = false;
+	float adaptiveerror = 0.05f;
+	int adaptivemax = 0; // 0 caps at 4x the path samples
+	bool emittersampling = true;
+	bool restir = false;
+	bool guiding = false;
+	int guidingpasses = 4; // pass n takes 2^n samples per pixel, before the final render
+	bool photons = false;
+	int photonpasses = 16;  // one map per pass, samples cycle through them
+	int photoncount = 100000; // emitted per pass
+	float photonradius = 0.0f; // radius of the first pass, 0 picks one from the scene bounds
+	bool mlt = false;
+	int mltbootstrap = 100000;
+	int mltchains = 1000;
+	float mltlargestep = 0.3f; // chance a mutation replaces the whole path
+	float mltsigma = 0.01f;    // width of a small step in primary sample space
+	bool bdpt = false;
+	bool cache = false;
+	int cachepasses = 4;     // one sample per pixel each, before the final render
+	float cachecell = 0.0f;  // cell width, 0 picks one from the scene bounds
+	bool wavefront = false;
+	int raybudget = 256; // rays one pixel's ray tree may trace in raytrace mode
+	bool fastmath = false; // polynomial transcendentals on the hot path, see util/fastmath.h
+	bool temporal = false; // average each frame into the last ones, reprojected through Renderer::reproject
+	bool preview = false;  // write 1/8, 1/4, 1/2 and full resolution previews before the final render
+	int previewsamples = 1; // per pixel, counted towards the final render
 };
 
 namespace GlobalConfig {
@@ -16,10 +45,68 @@ namespace GlobalConfig {
 	bool pathtrace();
 	bool denoise();
 	int pppasses();
+	bool lightAOVs();
+	int threads();
+	int seed();
+	bool adaptive();
+	float adaptiveError();
+	int adaptiveMax();
+	bool emitterSampling();
+	bool restir();
+	bool guiding();
+	int guidingPasses();
+	bool photons();
+	int photonPasses();
+	int photonCount();
+	float photonRadius();
+	bool mlt();
+	int mltBootstrap();
+	int mltChains();
+	float mltLargeStep();
+	float mltSigma();
+	bool bdpt();
+	bool cache();
+	int cachePasses();
+	float cacheCell();
+	bool wavefront();
+	int rayBudget();
+	bool fastMath();
+	bool temporal();
+	bool preview();
+	int previewSamples();
 	void minDepth(int i);
 	void maxDepth(int i);
 	void pathSamples(int i);
 	void pathTrace(bool b);
 	void denoise(bool b);
 	void pppasses(int i);
+	void lightAOVs(bool b);
+	void threads(int i);
+	void seed(int i);
+	void adaptive(bool b);
+	void adaptiveError(float f);
+	void adaptiveMax(int i);
+	void emitterSampling(bool b);
+	void restir(bool b);
+	void guiding(bool b);
+	void guidingPasses(int i);
+	void photons(bool b);
+	void photonPasses(int i);
+	void photonCount(int i);
+	void photonRadius(float f);
+	void mlt(bool b);
+	void mltBootstrap(int i);
+	void mltChains(int i);
+	void mltLargeStep(float f);
+	void mltSigma(float f);
+	void bdpt(bool b);
+	void cache(bool b);
+	void cachePasses(int i);
+	void cacheCell(float f);
+	void wavefront(bool b);
+	void rayBudget(int i);
+	void fastMath(bool b);
+	void temporal(bool b);
+	void preview(bool b);
+	void previewSamples(int i);
 };
@@ -15,9 +15,8 @@ DenoiseBuffer DenoiseUtils::generateBuffer(size_t w, size_t h) {
 void DenoiseUtils::evaluateAtIndex(DenoiseBuffer& buffer, const Scene& scene, const Image& image, size_t i) {
 	int row = i/image.w;
 	int col = i%image.w;
-	Ray ray = scene.camera.generateRay(image.w, image.h, col, row);
 	scene.pollMetadata(
-		scene.camera.generateRay(image.w, image.h, col, row),
+		scene.camera.generateRay(col, row),
 		buffer.normals[i], buffer.positions[i], buffer.albedo[i]);
 }
 
@@ -0,0 +1,117 @@
+#include "mlt.h"
+#include "renderer/config.h"
+#include "util/sampler.h"
+#include "util/jlm.h"
+#include <algorithm>
+#include <cmath>
+
+#define MLT_BOOTSTRAP_STREAM (~0ull)
+
+float Brightness(Spectrum& s) {
+	// what the chains are distributed by, zero exactly when the path adds nothing to the image
+	glm::vec3 c = s.rgb();
+	return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+uint64_t Stream(uint64_t stream) {
+	return stream ^ ((uint64_t)GlobalConfig::seed() << 32);
+}
+
+Spectrum Bootstrap(Scene& scene, PrimarySpace& space, size_t index, glm::vec2& raster) {
+	// a bootstrap path is a first large step, so a chain that starts from it replays it exactly
+	space.startIteration();
+	jlm::seed(Stream(MLT_BOOTSTRAP_STREAM), index);
+	Sampler::get().attach(&space);
+	Spectrum L = scene.shadeRaster(raster, index);
+	Sampler::get().attach(nullptr);
+	return L;
+}
+
+void Splat(std::vector<glm::vec3>& film, size_t w, const glm::vec2& raster, const glm::vec3& c) {
+	film[(size_t)raster.y * w + (size_t)raster.x] += c;
+}
+
+MLTBuffer MLTUtils::generateBuffer(size_t w, size_t h, size_t threads) {
+	MLTBuffer buffer{};
+	buffer.w = w;
+	buffer.h = h;
+	buffer.bootstrap.assign(std::max(1, GlobalConfig::mltBootstrap()), 0.0f);
+	buffer.films.assign(threads, std::vector<glm::vec3>(w*h, glm::vec3(0)));
+	buffer.chains = std::max(1, GlobalConfig::mltChains());
+	long long total = (long long)GlobalConfig::pathSamples() * w * h;
+	buffer.mutations = (total + buffer.chains - 1) / buffer.chains;
+	return buffer;
+}
+
+void MLTUtils::bootstrapAtIndex(MLTBuffer& buffer, Scene& scene, size_t index) {
+	PrimarySpace space(Stream(index), GlobalConfig::mltSigma(), GlobalConfig::mltLargeStep());
+	glm::vec2 raster;
+	Spectrum L = Bootstrap(scene, space, index, raster);
+	float f = Brightness(L);
+	buffer.bootstrap[index] = std::isfinite(f) ? f : 0.0f;
+}
+
+bool MLTUtils::normalize(MLTBuffer& buffer) {
+	// false when no bootstrap path found any light, there is nothing for the chains to explore
+	buffer.cdf.resize(buffer.bootstrap.size());
+	double total = 0.0;
+	for (size_t i = 0; i < buffer.bootstrap.size(); i++) {
+		total += buffer.bootstrap[i];
+		buffer.cdf[i] = total;
+	}
+	if (total <= 0.0) return false;
+	for (float& c : buffer.cdf) c /= total;
+	buffer.b = total / buffer.bootstrap.size();
+	return true;
+}
+
+void MLTUtils::runChain(MLTBuffer& buffer, Scene& scene, size_t chain, size_t thread) {
+	// the chain starts from a bootstrap path picked by brightness, so it starts out in equilibrium
+	std::vector<glm::vec3>& film = buffer.films[thread];
+	jlm::seed(Stream(chain), ~0ull);
+	size_t index = std::lower_bound(buffer.cdf.begin(), buffer.cdf.end(), jlm::random01()) - buffer.cdf.begin();
+	index = std::min(index, buffer.cdf.size() - 1);
+	PrimarySpace space(Stream(index), GlobalConfig::mltSigma(), GlobalConfig::mltLargeStep());
+	glm::vec2 current;
+	Spectrum Lcurrent = Bootstrap(scene, space, index, current);
+	float fcurrent = Brightness(Lcurrent);
+	space.accept();
+
+	// MUTATIONS
+	// both the proposal and the current path are splatted, weighted by how likely each is to be
+	// the chain's next state, which keeps rejected proposals from being wasted
+	Sampler& sampler = Sampler::get();
+	sampler.attach(&space);
+	for (long long m = 0; m < buffer.mutations; m++) {
+		space.startIteration();
+		jlm::seed(Stream(chain), m);
+		glm::vec2 proposed;
+		Spectrum Lproposed = scene.shadeRaster(proposed, m);
+		float fproposed = Brightness(Lproposed);
+		if (!std::isfinite(fproposed)) fproposed = 0.0f;
+		float a = fcurrent > 0.0f ? std::min(1.0f, fproposed / fcurrent) : 1.0f;
+		if (fproposed > 0.0f) Splat(film, buffer.w, proposed, Lproposed.rgb() * (a / fproposed));
+		if (fcurrent > 0.0f) Splat(film, buffer.w, current, Lcurrent.rgb() * ((1.0f - a) / fcurrent));
+		if (jlm::random01() < a) {
+			current = proposed;
+			Lcurrent = Lproposed;
+			fcurrent = fproposed;
+			space.accept();
+		} else {
+			space.reject();
+		}
+	}
+	sampler.attach(nullptr);
+}
+
+void MLTUtils::resolve(const MLTBuffer& buffer, Image& image) {
+	// every pixel received mutations in proportion to its brightness over b, so b over the
+	// mutations each pixel would get on average turns the splats back into radiance
+	if (buffer.chains == 0 || buffer.mutations == 0) return;
+	float scale = buffer.b * (float)(buffer.w * buffer.h) / ((float)buffer.mutations * (float)buffer.chains);
+	for (size_t i = 0; i < buffer.w * buffer.h; i++) {
+		glm::vec3 c = glm::vec3(0);
+		for (const std::vector<glm::vec3>& film : buffer.films) c += film[i];
+		image.colors[i] = c * scale;
+	}
+}
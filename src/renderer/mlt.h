@@ -0,0 +1,26 @@
+#pragma once
+
+#include "scene/scene.h"
+#include "renderer/image.h"
+#include <vector>
+
+// primary sample space metropolis. a bootstrap pass of independent paths estimates the film's
+// mean brightness and seeds the chains, which then spend their mutations where light arrives
+struct MLTBuffer {
+	std::vector<float> bootstrap;          // brightness of every bootstrap path
+	std::vector<float> cdf;
+	std::vector<std::vector<glm::vec3>> films; // splats, one film per thread
+	float b = 0.0f;                        // mean brightness over the film
+	size_t w = 0;
+	size_t h = 0;
+	size_t chains = 0;
+	long long mutations = 0;               // per chain
+};
+
+namespace MLTUtils {
+	MLTBuffer generateBuffer(size_t w, size_t h, size_t threads);
+	void bootstrapAtIndex(MLTBuffer& buffer, Scene& scene, size_t index);
+	bool normalize(MLTBuffer& buffer);
+	void runChain(MLTBuffer& buffer, Scene& scene, size_t chain, size_t thread);
+	void resolve(const MLTBuffer& buffer, Image& image);
+};
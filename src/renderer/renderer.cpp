@@ -4,13 +4,29 @@
 #include "scene/material.h"
 #include "scene/cie.h"
 #include "renderer/config.h"
+#include "util/fastmath.h"
 #include <thread>
+#include <chrono>
 #include <cstring>
 
 #define PROGRESS_REPORT true
-#define THREAD_HANDFUL 100
+#define PROGRESS_INTERVAL 100 // milliseconds the reporter sleeps between updates
+#define GUIDE_CHUNK 4096 // training paths whose records go into the guide at once
+#define PHOTON_RADIUS 0.005f // first pass radius as a share of the scene's diagonal
+#define CACHE_FLUSH 65536
+#define CACHE_SLOTS (1 << 18)
+#define CACHE_CELL 0.01f     // cell width as a share of the scene's diagonal
+#define WAVEFRONT_PATHS (1 << 14) // in flight at once, a batch takes as many whole pixels as fit
+#define PREVIEW_LEVELS 4 // 1/8, 1/4, 1/2 and full resolution
 
 Renderer::Renderer() {
+	m_aovsEnabled = false;
+	m_restirEnabled = false;
+	m_mltEnabled = false;
+	m_bdptEnabled = false;
+	m_wavefrontEnabled = false;
+	m_adaptiveEnabled = false;
+	m_temporalEnabled = false;
     MaterialUtils::initGlobalMaterials();
 	CIE::init();
 }
@@ -20,43 +36,300 @@ Image Renderer::render(std::string filepath, size_t w, size_t h) {
     return render(sd, w, h);
 }
 
-Image Renderer::render(Scene scene, size_t w, size_t h) {
+Image Renderer::render(Scene scene, size_t w, size_t h, std::string preview) {
     Image img{};
     if (!scene.validated) {
         WARN("Unable to render invalid scene");
         return img;
     }
-    size_t cores = std::thread::hardware_concurrency();
+    size_t cores = GlobalConfig::threads() > 0 ? GlobalConfig::threads() : std::thread::hardware_concurrency();
     INFO("Parallelizing across %d cores...", (int)cores);
-    m_counter = 0;
+    m_workers = cores;
+    m_progress = TileUtils::generateProgress(cores);
     img.w = w;
     img.h = h;
     img.colors.assign(w*h, glm::vec3(0));
     scene.camera.update(w, h);
+    FastMath::enabled = GlobalConfig::fastMath();
     std::vector<std::thread> threads;
     long long start = TIME();
     if (PROGRESS_REPORT) INFO("Generating BVH...");
+    // baked volumes are only tracked by the path kernel and the wavefront, which shade the same
+    // vertices, so they stay primitives when anything else could trace the scene
+    if (GlobalConfig::pathtrace() && !GlobalConfig::bdpt() && !GlobalConfig::photons() && !GlobalConfig::restir()) {
+        scene.prepareVolumes();
+    }
     scene.bvh = BVH::create(scene.primitives);
     scene.bvh2 = BVH::create(scene.lPrimitive);
+    scene.prepareEmitters();
+    scene.prepareKernels();
+    scene.lightTree = LightTree::create(scene.lights);
+    scene.lightGeometry = LightSampler::create(scene.lights);
     if (PROGRESS_REPORT) INFO("Rendering rays...")
     img.prepare = ((float)(TIME() - start) / 1000.0f);
     size_t base = (h*w)/cores;
     size_t extra = (h*w)%cores;
     int pixels = w*h;
-	m_threadpool = pixels;
-	if (GlobalConfig::denoise()) m_denoiser = DenoiseUtils::generateBuffer(w, h);
-    for (size_t i = 0; i < cores; i++) {
-        size_t start = i * base + std::min(i, extra);
-        size_t count = base + (i < extra ? 1 : 0);
-        threads.emplace_back(&Renderer::renderPixels, this, start, count, std::ref(img), std::ref(scene));
-    }
+	m_mltEnabled = GlobalConfig::mlt();
+	if (m_mltEnabled && !GlobalConfig::pathtrace()) {
+		WARN("MLT is only supported while pathtracing, skipping");
+		m_mltEnabled = false;
+	}
+	m_bdptEnabled = GlobalConfig::bdpt();
+	if (m_bdptEnabled && !GlobalConfig::pathtrace()) {
+		WARN("BDPT is only supported while pathtracing, skipping");
+		m_bdptEnabled = false;
+	}
+	if (m_bdptEnabled && m_mltEnabled) {
+		WARN("BDPT is not used by MLT, skipping");
+		m_bdptEnabled = false;
+	}
+	for (const Material& material : scene.materials) {
+		if (!m_bdptEnabled || material.convert().empty()) continue;
+		WARN("BDPT does not support wavelength conversion, skipping");
+		m_bdptEnabled = false;
+	}
+	if (m_bdptEnabled && GlobalConfig::adaptive()) WARN("Adaptive sampling is not supported with BDPT, skipping");
+	m_wavefrontEnabled = GlobalConfig::wavefront();
+	if (m_wavefrontEnabled && !GlobalConfig::pathtrace()) {
+		WARN("The wavefront engine is only supported while pathtracing, skipping");
+		m_wavefrontEnabled = false;
+	}
+	if (m_wavefrontEnabled && (m_mltEnabled || m_bdptEnabled)) {
+		WARN("The wavefront engine only runs the path tracer, skipping");
+		m_wavefrontEnabled = false;
+	}
+	if (m_wavefrontEnabled && GlobalConfig::adaptive()) WARN("Adaptive sampling is not supported by the wavefront engine, skipping");
+	m_adaptiveEnabled = GlobalConfig::adaptive() && GlobalConfig::pathtrace() && !m_mltEnabled && !m_bdptEnabled && !m_wavefrontEnabled;
+	m_restirEnabled = GlobalConfig::restir();
+	if (m_restirEnabled && m_bdptEnabled) {
+		WARN("ReSTIR is not used by BDPT, skipping");
+		m_restirEnabled = false;
+	}
+	if (m_restirEnabled && m_wavefrontEnabled) {
+		WARN("ReSTIR is not used by the wavefront engine, skipping");
+		m_restirEnabled = false;
+	}
+	if (m_restirEnabled && m_mltEnabled) {
+		WARN("ReSTIR is not used by MLT, skipping");
+		m_restirEnabled = false;
+	}
+	if (m_restirEnabled && !GlobalConfig::pathtrace()) {
+		WARN("ReSTIR is only supported while pathtracing, skipping");
+		m_restirEnabled = false;
+	}
+	m_temporalEnabled = GlobalConfig::temporal();
+	if (m_temporalEnabled && m_mltEnabled) {
+		WARN("Temporal accumulation is not supported with MLT, skipping");
+		m_temporalEnabled = false;
+	}
+	if (m_temporalEnabled && m_wavefrontEnabled) {
+		WARN("Temporal accumulation is not supported by the wavefront engine, skipping");
+		m_temporalEnabled = false;
+	}
+	if (GlobalConfig::denoise() || m_restirEnabled || m_temporalEnabled) m_denoiser = DenoiseUtils::generateBuffer(w, h);
+	m_samplemap.assign(w*h, 0);
+	m_training.assign(w*h, glm::vec3(0));
+	m_trainingSamples = 0;
+	m_width = w;
+	m_height = h;
+	m_aovsEnabled = GlobalConfig::lightAOVs();
+	if (m_aovsEnabled && !GlobalConfig::pathtrace()) {
+		WARN("Light AOVs are only supported while pathtracing, skipping");
+		m_aovsEnabled = false;
+	}
+	if (m_aovsEnabled && m_mltEnabled) {
+		WARN("Light AOVs are not supported with MLT, skipping");
+		m_aovsEnabled = false;
+	}
+	if (m_aovsEnabled && m_bdptEnabled) {
+		WARN("Light AOVs are not supported with BDPT, skipping");
+		m_aovsEnabled = false;
+	}
+	if (m_aovsEnabled && m_wavefrontEnabled) {
+		WARN("Light AOVs are not supported by the wavefront engine, skipping");
+		m_aovsEnabled = false;
+	}
+	if (m_aovsEnabled) {
+		scene.prepareAOVs();
+		m_aovs = AOVUtils::generateBuffer(w, h, scene);
+	}
+	bool previewing = GlobalConfig::preview() && !preview.empty();
+	if (previewing && !GlobalConfig::pathtrace()) {
+		WARN("Previews are only supported while pathtracing, skipping");
+		previewing = false;
+	}
+	if (previewing && (m_mltEnabled || m_bdptEnabled || m_wavefrontEnabled)) {
+		WARN("Previews are only reused by the path tracer, skipping");
+		previewing = false;
+	}
+	if (previewing) {
+		// PREVIEW LEVELS
+		// before anything slower is prepared, each level shades the pixels on a grid twice as fine
+		// as the last one's and fills the rest from the shaded pixel at the corner of their block.
+		// a pixel is only shaded by the first level to reach it, and its samples then count
+		// towards the final render like training paths do, unless photons are on
+		Image shown = img;
+		int samples = std::max(1, GlobalConfig::previewSamples());
+		for (int level = PREVIEW_LEVELS - 1; level >= 0; level--) {
+			size_t stride = 1 << level;
+			size_t cells = ((w + stride - 1) / stride) * ((h + stride - 1) / stride);
+			for (size_t i = 0; i < cores; i++) {
+				size_t start = i * (cells / cores) + std::min(i, cells % cores);
+				size_t count = cells / cores + (i < cells % cores ? 1 : 0);
+				threads.emplace_back(&Renderer::previewPixels, this, start, count, std::ref(scene), stride);
+			}
+			for (auto& thread : threads) thread.join();
+			threads.clear();
+			for (size_t i = 0; i < w*h; i++) {
+				size_t x = i % w;
+				size_t y = i / w;
+				shown.colors[i] = m_training[(y - y % stride) * w + x - x % stride] / (float)samples;
+			}
+			if (!shown.save(preview)) {
+				WARN("Unable to save preview");
+			} else if (PROGRESS_REPORT) {
+				INFO("Saved 1/%d resolution preview after %.3f seconds", (int)stride, (float)(TIME() - start) / 1000.0f);
+			}
+		}
+		// previews run before the photon pass, so their paths gathered no caustics from a photon
+		// map. with photons on they would darken the caustics, so they are only shown
+		if (GlobalConfig::photons() && scene.bvh.size() > 0) {
+			m_training.assign(w*h, glm::vec3(0));
+		} else {
+			m_trainingSamples += samples;
+		}
+	}
+	if (m_restirEnabled) {
+		// the g-buffer and every pixel's candidates have to exist before neighbours can be reused,
+		// so both passes run to completion over the whole image before shading starts
+		if (m_reservoirs.w != w || m_reservoirs.h != h) m_reservoirs = ReSTIRUtils::generateBuffer(w, h);
+		for (int pass = 0; pass < 2; pass++) {
+			for (size_t i = 0; i < cores; i++) {
+				size_t start = i * base + std::min(i, extra);
+				size_t count = base + (i < extra ? 1 : 0);
+				threads.emplace_back(&Renderer::prepareReservoirs, this, start, count, std::ref(img), std::ref(scene), pass == 1);
+			}
+			for (auto& thread : threads) thread.join();
+			threads.clear();
+		}
+	}
+	if (GlobalConfig::photons() && !GlobalConfig::pathtrace()) {
+		WARN("Photon mapping is only supported while pathtracing, skipping");
+	} else if (GlobalConfig::photons() && m_bdptEnabled) {
+		WARN("Photon mapping is not used by BDPT, skipping");
+	} else if (GlobalConfig::photons() && m_wavefrontEnabled) {
+		WARN("Photon mapping is not used by the wavefront engine, skipping");
+	} else if (GlobalConfig::photons() && scene.bvh.size() > 0) {
+		// every thread traces a slice of every pass, then each pass is hashed on a thread of its own
+		if (PROGRESS_REPORT) INFO("Tracing photons...");
+		scene.preparePhotons();
+		size_t passes = std::max(1, GlobalConfig::photonPasses());
+		size_t total = passes * std::max(0, GlobalConfig::photonCount());
+		std::vector<std::vector<Photon>> traced(passes * cores);
+		for (size_t i = 0; i < cores; i++) {
+			size_t start = i * (total / cores) + std::min(i, total % cores);
+			size_t count = total / cores + (i < total % cores ? 1 : 0);
+			threads.emplace_back(&Renderer::tracePhotons, this, start, count, std::ref(scene), &traced[i * passes]);
+		}
+		for (auto& thread : threads) thread.join();
+		threads.clear();
+		scene.photonMaps.assign(passes, PhotonMap{});
+		for (size_t i = 0; i < std::min(cores, passes); i++)
+			threads.emplace_back(&Renderer::buildPhotons, this, i, cores, std::ref(scene), std::ref(traced), cores);
+		for (auto& thread : threads) thread.join();
+		threads.clear();
+		size_t stored = 0;
+		for (const PhotonMap& map : scene.photonMaps) stored += map.photons.size();
+		if (PROGRESS_REPORT) INFO("Stored %d caustic photons over %d passes", (int)stored, (int)passes);
+	}
+	if (GlobalConfig::guiding() && !GlobalConfig::pathtrace()) {
+		WARN("Path guiding is only supported while pathtracing, skipping");
+	} else if (GlobalConfig::guiding() && m_bdptEnabled) {
+		WARN("Path guiding is not used by BDPT, skipping");
+	} else if (GlobalConfig::guiding() && m_wavefrontEnabled) {
+		WARN("Path guiding is not used by the wavefront engine, skipping");
+	} else if (GlobalConfig::guiding() && scene.bvh.size() > 0) {
+		// every pass learns from paths guided by the one before, the final render only reads
+		if (PROGRESS_REPORT) INFO("Training path guide...");
+		scene.guide = Guiding::create(scene.bvh[0].min, scene.bvh[0].max);
+		for (int pass = 0; pass < GlobalConfig::guidingPasses(); pass++) {
+			m_guideChunks = 0;
+			for (size_t i = 0; i < cores; i++) threads.emplace_back(&Renderer::trainGuide, this, i, std::ref(scene), pass);
+			for (auto& thread : threads) thread.join();
+			threads.clear();
+			Guiding::refine(scene.guide);
+			m_trainingSamples += 1 << pass;
+		}
+	}
+	if (GlobalConfig::cache() && !GlobalConfig::pathtrace()) {
+		WARN("Radiance caching is only supported while pathtracing, skipping");
+	} else if (GlobalConfig::cache() && m_bdptEnabled) {
+		WARN("Radiance caching is not used by BDPT, skipping");
+	} else if (GlobalConfig::cache() && m_wavefrontEnabled) {
+		WARN("Radiance caching is not used by the wavefront engine, skipping");
+	} else if (GlobalConfig::cache() && m_aovsEnabled) {
+		WARN("Radiance caching is not supported with light AOVs, skipping");
+	} else if (GlobalConfig::cache() && scene.bvh.size() > 0) {
+		// every pass ends its paths in what the passes before it cached, so light spreads one
+		// bounce further each pass while the paths carrying it stay short
+		if (PROGRESS_REPORT) INFO("Warming radiance cache...");
+		float cell = GlobalConfig::cacheCell() > 0.0f ? GlobalConfig::cacheCell()
+			: glm::length(scene.bvh[0].max - scene.bvh[0].min) * CACHE_CELL;
+		m_cache = Caching::generateTable(CACHE_SLOTS, cell);
+		scene.cache = RadianceCache{};
+		for (int pass = 0; pass < GlobalConfig::cachePasses(); pass++) {
+			for (size_t i = 0; i < cores; i++) {
+				size_t start = i * base + std::min(i, extra);
+				size_t count = base + (i < extra ? 1 : 0);
+				threads.emplace_back(&Renderer::warmCache, this, start, count, std::ref(scene), pass);
+			}
+			for (auto& thread : threads) thread.join();
+			threads.clear();
+			Caching::update(scene.cache, m_cache);
+		}
+		size_t cells = 0;
+		for (uint64_t key : scene.cache.keys) if (key != 0) cells++;
+		if (PROGRESS_REPORT) INFO("Cached radiance in %d cells over %d passes", (int)cells, scene.cache.passes);
+	}
+	if (m_bdptEnabled) {
+		// light subpaths leave from the same sources photons do
+		scene.preparePhotons();
+		m_splats = SplatUtils::generateBuffer(w, h);
+	}
+	int target = pixels;
+	if (m_mltEnabled) {
+		// the bootstrap has to finish before any chain can pick where to start
+		if (PROGRESS_REPORT) INFO("Bootstrapping MLT chains...");
+		m_mlt = MLTUtils::generateBuffer(w, h, cores);
+		size_t paths = m_mlt.bootstrap.size();
+		for (size_t i = 0; i < cores; i++) {
+			size_t start = i * (paths / cores) + std::min(i, paths % cores);
+			size_t count = paths / cores + (i < paths % cores ? 1 : 0);
+			threads.emplace_back(&Renderer::bootstrapChains, this, start, count, std::ref(scene));
+		}
+		for (auto& thread : threads) thread.join();
+		threads.clear();
+		if (!MLTUtils::normalize(m_mlt)) m_mlt.chains = 0;
+		target = m_mlt.chains;
+		for (size_t i = 0; i < cores; i++) threads.emplace_back(&Renderer::runChains, this, i, cores, std::ref(scene));
+	} else if (m_wavefrontEnabled) {
+		// the same workers run every stage of every batch, each takes its share of a stage's queue
+		size_t samples = std::max(1, GlobalConfig::pathSamples());
+		size_t batch = std::max((size_t)1, (size_t)WAVEFRONT_PATHS / samples);
+		m_wavefront = WavefrontUtils::generateBuffer(batch * samples, samples, cores);
+		m_barrier.workers = cores;
+		for (size_t i = 0; i < cores; i++) threads.emplace_back(&Renderer::renderWavefront, this, i, std::ref(img), std::ref(scene));
+	} else {
+		// square tiles along a z curve, every worker starts on a run of its own and steals from the
+		// others once it is through
+		m_tiles = TileUtils::generateSchedule(w, h, cores);
+		for (size_t i = 0; i < cores; i++) threads.emplace_back(&Renderer::renderPixels, this, i, std::ref(img), std::ref(scene));
+	}
     while (PROGRESS_REPORT) {
-        int counter = 0;
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            counter = m_counter;
-        }
-        float pct = 100.0f*((float)counter)/((float)pixels);
+        // the workers only ever bump counters of their own, this thread sums them between naps
+        int counter = TileUtils::progress(m_progress.get(), m_workers);
+        float pct = target > 0 ? 100.0f*((float)counter)/((float)target) : 100.0f;
         char backspace_buffer[128] = { 0 };
         char eq_buffer[64] = { 0 };
         char sp_buffer[64] = { 0 };
@@ -72,13 +345,35 @@ Image Renderer::render(Scene scene, size_t w, size_t h) {
         sp_buffer[50 - b] = '\0';
         sp2_buffer[7 - strlen(pct_buffer)] = '\0';
         printf("Progress: [%s%s] %s%%%s", eq_buffer, sp_buffer, pct_buffer, sp2_buffer);
-        if (counter >= pixels) {
+        if (counter >= target) {
             printf("\n");
             break;
         }
         printf("%s", backspace_buffer);
+        std::this_thread::sleep_for(std::chrono::milliseconds(PROGRESS_INTERVAL));
     }
     for (auto& thread : threads) thread.join();
+	if (m_wavefrontEnabled) m_wavefront = WavefrontBuffer();
+	if (m_mltEnabled) {
+		MLTUtils::resolve(m_mlt, img);
+		if (GlobalConfig::denoise()) for (size_t i = 0; i < w*h; i++) DenoiseUtils::evaluateAtIndex(m_denoiser, scene, img, i);
+	}
+	if (m_bdptEnabled) {
+		// every pixel traced one light subpath per sample, so the splats average over the samples too
+		SplatUtils::resolve(m_splats, img, 1.0f / (float)GlobalConfig::pathSamples());
+	}
+	if (m_temporalEnabled) {
+		// every pixel's new samples are averaged into what it saw of the same surface before
+		if (m_temporal.w != w || m_temporal.h != h) m_temporal = TemporalUtils::generateBuffer(w, h);
+		for (size_t i = 0; i < w*h; i++) TemporalUtils::accumulateAtIndex(m_temporal, m_denoiser, img, i);
+		TemporalUtils::advance(m_temporal, scene, m_denoiser, img);
+	}
+	if (m_restirEnabled) ReSTIRUtils::advance(m_reservoirs, m_denoiser);
+	if (m_adaptiveEnabled) {
+		long long total = 0;
+		for (int spent : m_samplemap) total += spent;
+		INFO("Adaptive sampling averaged %.2f samples per pixel", (float)total / (float)pixels);
+	}
 	long long post = TIME();	
     img.post = ((float)(TIME() - post) / 1000.0f);
     start = TIME() - start;
@@ -92,29 +387,193 @@ bool Renderer::saveComposites(std::string filepath) {
 	return true;
 }
 
-void Renderer::renderPixels(size_t start, size_t count, Image& image, Scene& scene) {
-	while (true) {
-		int groupstart = 0;
-		int groupend = 0;
-		{
-			std::lock_guard<std::mutex> lock(m_mutex);
-			if (m_threadpool > THREAD_HANDFUL) {
-				groupend = m_threadpool;
-				groupstart = m_threadpool - THREAD_HANDFUL;
-				m_threadpool -= THREAD_HANDFUL;
-			} else if (m_threadpool > 0) {
-				groupend = m_threadpool;
-				groupstart = 0;
-				m_threadpool = 0;
-			} else {
-				return;
-			}
+bool Renderer::saveSampleMap(std::string filepath) {
+	// every pixel spent the same when the integrator did not sample adaptively, there is no map to show
+	if (!m_adaptiveEnabled) return false;
+	Image map{};
+	map.w = m_width;
+	map.h = m_height;
+	int most = 1;
+	for (int spent : m_samplemap) most = std::max(most, spent);
+	for (int spent : m_samplemap) map.colors.push_back(glm::vec3((float)spent / (float)most));
+	return map.save(filepath + ".spp.png");
+}
+
+bool Renderer::saveAOVs(std::string filepath) {
+	if (m_aovsEnabled) return AOVUtils::save(m_aovs, filepath + ".aov");
+	return true;
+}
+
+void Renderer::reproject(const glm::mat4& motion) {
+	// frames skipped in between add up
+	m_temporal.motion = motion * m_temporal.motion;
+}
+
+void Renderer::prepareReservoirs(size_t start, size_t count, Image& image, Scene& scene, bool spatial) {
+	for (size_t i = start; i < start + count; i++) {
+		if (spatial) {
+			ReSTIRUtils::resampleAtIndex(m_reservoirs, scene, m_denoiser, i);
+		} else {
+			DenoiseUtils::evaluateAtIndex(m_denoiser, scene, image, i);
+			ReSTIRUtils::sampleAtIndex(m_reservoirs, scene, m_denoiser, i);
+		}
+	}
+}
+
+void Renderer::trainGuide(size_t worker, Scene& scene, int pass) {
+	// workers take turns at chunks of pixels, and a chunk's records wait for every chunk before it,
+	// so the guide sums them in pixel order however many threads trained it
+	std::vector<GuideRecord> records;
+	size_t pixels = m_width * m_height;
+	size_t size = std::max(GUIDE_CHUNK >> pass, 1);
+	for (size_t chunk = worker; chunk * size < pixels; chunk += m_workers) {
+		for (size_t i = chunk * size; i < std::min((chunk + 1) * size, pixels); i++) {
+			m_training[i] += scene.train(i%m_width, i/m_width, pass, records).rgb();
 		}
-		for (int i = groupstart; i < groupend; i++) {
-			image.colors[i] = scene.shade(i%image.w, i/image.w).rgb();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_recorded.wait(lock, [&] { return m_guideChunks == chunk; });
+		Guiding::record(scene.guide, records);
+		records.clear();
+		m_guideChunks++;
+		m_recorded.notify_all();
+	}
+}
+
+void Renderer::warmCache(size_t start, size_t count, Scene& scene, int pass) {
+	// the table takes records from every thread at once, so flushing needs no lock
+	std::vector<CacheRecord> records;
+	for (size_t i = start; i < start + count; i++) {
+		scene.warm(i%m_width, i/m_width, pass, records);
+		if (records.size() < CACHE_FLUSH && i + 1 < start + count) continue;
+		Caching::record(m_cache, records);
+		records.clear();
+	}
+}
+
+void Renderer::previewPixels(size_t start, size_t count, Scene& scene, size_t stride) {
+	// cells of the level's grid, leaving out those the coarser level before it already shaded
+	size_t columns = (m_width + stride - 1) / stride;
+	for (size_t i = start; i < start + count; i++) {
+		size_t x = (i % columns) * stride;
+		size_t y = (i / columns) * stride;
+		if ((stride << 1) < (1 << PREVIEW_LEVELS) && x % (stride << 1) == 0 && y % (stride << 1) == 0) continue;
+		m_training[y * m_width + x] += scene.preview(x, y).rgb();
+	}
+}
+
+void Renderer::tracePhotons(size_t start, size_t count, Scene& scene, std::vector<Photon>* passes) {
+	for (size_t i = start; i < start + count; i++) {
+		uint32_t pass = i / GlobalConfig::photonCount();
+		scene.tracePhoton(pass, i % GlobalConfig::photonCount(), passes[pass]);
+	}
+}
+
+void Renderer::bootstrapChains(size_t start, size_t count, Scene& scene) {
+	for (size_t i = start; i < start + count; i++) MLTUtils::bootstrapAtIndex(m_mlt, scene, i);
+}
+
+void Renderer::runChains(size_t first, size_t stride, Scene& scene) {
+	// chains are dealt out round robin, each thread splats into a film of its own
+	for (size_t chain = first; chain < m_mlt.chains; chain += stride) {
+		MLTUtils::runChain(m_mlt, scene, chain, first);
+		m_progress[first].done.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void Renderer::buildPhotons(size_t first, size_t stride, Scene& scene, std::vector<std::vector<Photon>>& traced, size_t parts) {
+	// slices are joined in thread order, so the maps come out the same however the work was split
+	size_t passes = scene.photonMaps.size();
+	float radius = GlobalConfig::photonRadius() > 0.0f ? GlobalConfig::photonRadius()
+		: glm::length(scene.bvh[0].max - scene.bvh[0].min) * PHOTON_RADIUS;
+	for (size_t pass = first; pass < passes; pass += stride) {
+		std::vector<Photon> photons;
+		for (size_t part = 0; part < parts; part++) {
+			std::vector<Photon>& slice = traced[part * passes + pass];
+			photons.insert(photons.end(), slice.begin(), slice.end());
+			std::vector<Photon>().swap(slice);
+		}
+		scene.photonMaps[pass] = PhotonMapping::create(std::move(photons), PhotonMapping::radius(radius, pass));
+	}
+}
+
+static inline void share(size_t worker, size_t workers, size_t n, size_t& start, size_t& count) {
+	// a contiguous share of a queue per worker
+	start = worker * (n / workers) + std::min(worker, n % workers);
+	count = n / workers + (worker < n % workers ? 1 : 0);
+}
+
+void Renderer::renderWavefront(size_t worker, Image& image, Scene& scene) {
+	// batches of whole pixels. every path of a batch is extended by one vertex per round of
+	// stages, until none has a ray left to trace. every worker takes its share of a stage and waits
+	// for the rest before the next stage reads what they wrote. a worker compacts, traces and
+	// counts the kinds of the paths it shaded itself, and tests the shadow rays it queued, so
+	// only the counts have to be shared before the queues that depend on them are written
+	WavefrontBuffer& buffer = m_wavefront;
+	size_t pixels = image.w * image.h;
+	size_t batch = buffer.capacity / buffer.samples;
+	size_t start, count;
+	for (size_t first = 0; first < pixels; first += batch) {
+		if (worker == 0) {
+			buffer.first = first;
+			buffer.pixels = std::min(batch, pixels - first);
+		}
+		WavefrontUtils::wait(m_barrier);
+		share(worker, m_workers, buffer.pixels * buffer.samples, start, count);
+		WavefrontUtils::generate(buffer, scene, start, count);
+		while (true) {
+			WavefrontUtils::count(buffer, worker, start, count);
+			WavefrontUtils::wait(m_barrier);
+			size_t remaining = WavefrontUtils::remaining(buffer);
+			if (remaining == 0) break;
+			WavefrontUtils::compact(buffer, worker, start, count);
+			scene.tracePaths(buffer, start, count);
+			WavefrontUtils::histogram(buffer, worker, start, count);
+			WavefrontUtils::wait(m_barrier);
+			WavefrontUtils::sort(buffer, worker, start, count);
+			WavefrontUtils::wait(m_barrier);
+			share(worker, m_workers, remaining, start, count);
+			scene.shadePaths(buffer, start, count, buffer.shadows[worker]);
+			scene.testShadows(buffer, buffer.shadows[worker]);
+		}
+		share(worker, m_workers, buffer.pixels, start, count);
+		WavefrontUtils::resolve(buffer, image, start, count);
+		for (size_t i = first + start; i < first + start + count; i++) {
+			m_samplemap[i] = buffer.samples;
 			if (GlobalConfig::denoise()) DenoiseUtils::evaluateAtIndex(m_denoiser, scene, image, i);
-			std::lock_guard<std::mutex> lock(m_mutex);
-			m_counter++;
 		}
+		m_progress[worker].done.fetch_add(count, std::memory_order_relaxed);
+		// the first worker moves the buffer on to the next batch only once every pixel is resolved
+		WavefrontUtils::wait(m_barrier);
+	}
+}
+
+void Renderer::renderPixels(size_t worker, Image& image, Scene& scene) {
+	std::vector<Spectrum> aov(m_aovsEnabled ? m_aovs.count : 0);
+	SplatBuffer* splats = m_bdptEnabled ? &m_splats : nullptr;
+	uint32_t tile;
+	while (TileUtils::next(m_tiles, worker, tile)) {
+		size_t x0, y0, x1, y1;
+		TileUtils::bounds(m_tiles, tile, x0, y0, x1, y1);
+		for (size_t y = y0; y < y1; y++) {
+			for (size_t x = x0; x < x1; x++) {
+				size_t i = y * image.w + x;
+				const Reservoir* reservoir = m_restirEnabled ? &m_reservoirs.reservoirs[i] : nullptr;
+				if (m_aovsEnabled) {
+					for (int c = 0; c < aov.size(); c++) aov[c] = Spectrum(0.0f);
+					image.colors[i] = scene.shade(x, y, &aov, &m_samplemap[i], reservoir, splats).rgb();
+					std::copy(aov.begin(), aov.end(), m_aovs.channels.begin() + i*m_aovs.count);
+				} else {
+					image.colors[i] = scene.shade(x, y, nullptr, &m_samplemap[i], reservoir, splats).rgb();
+				}
+				if (m_trainingSamples > 0) {
+					// training paths are unbiased estimates too, so they are averaged in rather than thrown
+					// away. the aovs and the sample map only describe the final render
+					int spent = m_samplemap[i];
+					image.colors[i] = (image.colors[i] * (float)spent + m_training[i]) / (float)(spent + m_trainingSamples);
+				}
+				if ((GlobalConfig::denoise() || m_temporalEnabled) && !m_restirEnabled) DenoiseUtils::evaluateAtIndex(m_denoiser, scene, image, i);
+			}
+		}
+		m_progress[worker].done.fetch_add((x1 - x0) * (y1 - y0), std::memory_order_relaxed);
 	}
 }
@@ -1,8 +1,16 @@
 #pragma once
 #include "scene/scene.h"
 #include "renderer/denoise.h"
+#include "renderer/aov.h"
+#include "renderer/restir.h"
+#include "renderer/mlt.h"
+#include "renderer/splat.h"
+#include "renderer/wavefront.h"
+#include "renderer/temporal.h"
+#include "renderer/tiles.h"
 #include "renderer/image.h"
 #include <mutex>
+#include <condition_variable>
 #include <string>
 
 class Renderer {
@@ -10,13 +18,48 @@ public:
     Renderer();
 public:
     Image render(std::string filepath, size_t w, size_t h);
-    Image render(Scene scene, size_t w, size_t h);
+    Image render(Scene scene, size_t w, size_t h, std::string preview = ""); // previews are written to preview, when given
 	bool saveComposites(std::string filepath);
+	bool saveAOVs(std::string filepath);
+	bool saveSampleMap(std::string filepath);
+	void reproject(const glm::mat4& motion); // how the scene moved since the last frame rendered
 private:
-    void renderPixels(size_t start, size_t count, Image& image, Scene& scene);
+    void renderPixels(size_t worker, Image& image, Scene& scene);
+    void prepareReservoirs(size_t start, size_t count, Image& image, Scene& scene, bool spatial);
+    void trainGuide(size_t worker, Scene& scene, int pass);
+    void warmCache(size_t start, size_t count, Scene& scene, int pass);
+    void previewPixels(size_t start, size_t count, Scene& scene, size_t stride);
+    void tracePhotons(size_t start, size_t count, Scene& scene, std::vector<Photon>* passes);
+    void bootstrapChains(size_t start, size_t count, Scene& scene);
+    void runChains(size_t first, size_t stride, Scene& scene);
+    void buildPhotons(size_t first, size_t stride, Scene& scene, std::vector<std::vector<Photon>>& traced, size_t parts);
+    void renderWavefront(size_t worker, Image& image, Scene& scene);
 private:
     std::mutex m_mutex;
-    int m_counter;
-	int m_threadpool;
+	TileSchedule m_tiles;
+	std::unique_ptr<WorkerProgress[]> m_progress; // pixels, or chains for MLT, finished by each worker
+	size_t m_workers;
+	std::condition_variable m_recorded; // signalled under m_mutex as each guide chunk is recorded
+	size_t m_guideChunks; // chunks recorded into the guide this pass, they go in pixel order
 	DenoiseBuffer m_denoiser;
+	AOVBuffer m_aovs;
+	bool m_aovsEnabled;
+	ReservoirBuffer m_reservoirs;
+	bool m_restirEnabled;
+	MLTBuffer m_mlt;
+	bool m_mltEnabled;
+	SplatBuffer m_splats; // light tracing, shared by every thread
+	bool m_bdptEnabled;
+	CacheTable m_cache; // recorded into by every thread at once while the cache warms
+	WavefrontBuffer m_wavefront; // shared by every worker, which meet at m_barrier between stages
+	WavefrontBarrier m_barrier;
+	bool m_wavefrontEnabled;
+	bool m_adaptiveEnabled; // sampled adaptively, so there is a sample map worth saving
+	TemporalBuffer m_temporal;
+	bool m_temporalEnabled;
+	std::vector<int> m_samplemap;
+	std::vector<glm::vec3> m_training; // summed colour of every pixel's training and preview paths
+	int m_trainingSamples;
+	size_t m_width;
+	size_t m_height;
 };
@@ -0,0 +1,181 @@
+#include "restir.h"
+#include "util/sampler.h"
+#include "util/jlm.h"
+#include <limits>
+#include <cmath>
+
+#define MAX_NEIGHBOURS 16
+
+// a reservoir to merge, with the surface it was built for and how many candidates it stands for
+struct Source {
+	const Reservoir* r;
+	glm::vec3 p;
+	glm::vec3 n;
+	float M;
+};
+
+Reservoir Combine(const Source* sources, int count, const Scene& scene) {
+	// sources[0] is the pixel itself. each pick is weighted by the balance heuristic over how likely
+	// every source was to make it, so neighbours with very different lighting stay quiet
+	Reservoir out{};
+	const Source& own = sources[0];
+	out.origin = own.p;
+	out.normal = own.n;
+	for (int i = 0; i < count; i++) {
+		const Reservoir& r = *sources[i].r;
+		out.M += sources[i].M;
+		if (r.light < 0 || r.W <= 0.0f) continue;
+		float mine = 0.0f;
+		float total = 0.0f;
+		for (int j = 0; j < count; j++) {
+			float t = sources[j].M * ReSTIRUtils::target(scene, r.light, r.p, r.n, sources[j].p, sources[j].n);
+			if (j == i) mine = t;
+			total += t;
+		}
+		if (mine <= 0.0f) continue;
+		float w = mine / total * ReSTIRUtils::target(scene, r.light, r.p, r.n, own.p, own.n) * r.W;
+		if (w <= 0.0f) continue;
+		out.wsum += w;
+		if (jlm::random01() * out.wsum < w) {
+			out.light = r.light;
+			out.p = r.p;
+			out.n = r.n;
+		}
+	}
+	float t = out.light < 0 ? 0.0f : ReSTIRUtils::target(scene, out.light, out.p, out.n, own.p, own.n);
+	out.W = t > 0.0f ? out.wsum / t : 0.0f;
+	return out;
+}
+
+void Seed(const ReservoirBuffer& buffer, size_t x, size_t y, int pass) {
+	// reservoir updates need independent numbers, so they draw from the pcg stream rather than the
+	// stratified sampler, on a stream of their own so they never line up with a path's draws
+	jlm::seed(((uint64_t)y << 32) | x, ~(((uint64_t)buffer.frame << 1) | pass));
+}
+
+bool ReSTIRUtils::similar(const glm::vec3& n1, const glm::vec3& p1, const glm::vec3& n2, const glm::vec3& p2, const glm::vec3& eye) {
+	// reuse only across the same surface, judged by normal and distance to the camera
+	if (p2.x == std::numeric_limits<float>::max()) return false;
+	float d1 = glm::length(p1 - eye);
+	float d2 = glm::length(p2 - eye);
+	return glm::dot(n1, n2) > 0.9f && std::abs(d1 - d2) < 0.1f * d1;
+}
+
+ReservoirBuffer ReSTIRUtils::generateBuffer(size_t w, size_t h) {
+	ReservoirBuffer buffer{};
+	buffer.w = w;
+	buffer.h = h;
+	buffer.initial.assign(w*h, Reservoir{});
+	buffer.reservoirs.assign(w*h, Reservoir{});
+	return buffer;
+}
+
+void ReSTIRUtils::sampleAtIndex(ReservoirBuffer& buffer, const Scene& scene, const DenoiseBuffer& gbuffer, size_t i) {
+	Reservoir r{};
+	glm::vec3 p = gbuffer.positions[i];
+	glm::vec3 n = gbuffer.normals[i];
+	if (p.x == std::numeric_limits<float>::max() || scene.lightTree.size() == 0) {
+		buffer.initial[i] = r;
+		return;
+	}
+	Sampler& sampler = Sampler::get();
+	sampler.start(i%buffer.w, i/buffer.w, buffer.frame);
+	Seed(buffer, i%buffer.w, i/buffer.w, 0);
+	uint32_t dimension = sampler.reserve(3);
+	int count = buffer.candidates;
+
+	// CANDIDATES
+	// the target is the unshadowed contribution, the source pdf is converted to area measure to match it
+	for (int c = 0; c < count; c++) {
+		r.M += 1.0f;
+		float pmf;
+		int li = LightTree::sample(scene.lightTree, p, n, sampler.get1D(dimension + 2, c, count), pmf);
+		if (li < 0) continue;
+		LightSample ls;
+		if (!LightSampler::sample(scene.lights[li], scene.lightGeometry[li], p, sampler.get2D(dimension, c, count), ls)) continue;
+		glm::vec3 d = ls.p - p;
+		float dist2 = glm::dot(d, d);
+		float pdf = pmf * ls.pdf * -glm::dot(d, ls.n) / (dist2 * std::sqrt(dist2));
+		if (pdf <= 0.0f) continue;
+		float w = target(scene, li, ls.p, ls.n, p, n) / pdf;
+		if (w <= 0.0f) continue;
+		r.wsum += w;
+		if (jlm::random01() * r.wsum < w) {
+			r.light = li;
+			r.p = ls.p;
+			r.n = ls.n;
+		}
+	}
+	float t = r.light < 0 ? 0.0f : target(scene, r.light, r.p, r.n, p, n);
+	r.W = t > 0.0f ? r.wsum / (r.M * t) : 0.0f;
+
+	// VISIBILITY
+	// an occluded pick is not worth passing on to neighbours or the next frame
+	if (r.W > 0.0f && scene.occluded(p, r.p)) r.W = 0.0f;
+
+	// TEMPORAL REUSE
+	if (buffer.previous.size() == buffer.w*buffer.h && similar(n, p, buffer.normals[i], buffer.positions[i], scene.camera.position)) {
+		Source sources[2] = {
+			{ &r, p, n, r.M },
+			{ &buffer.previous[i], buffer.positions[i], buffer.normals[i], std::min(buffer.previous[i].M, buffer.history * count) }
+		};
+		r = Combine(sources, 2, scene);
+	}
+	buffer.initial[i] = r;
+}
+
+void ReSTIRUtils::resampleAtIndex(ReservoirBuffer& buffer, const Scene& scene, const DenoiseBuffer& gbuffer, size_t i) {
+	const Reservoir& own = buffer.initial[i];
+	glm::vec3 p = gbuffer.positions[i];
+	glm::vec3 n = gbuffer.normals[i];
+	if (p.x == std::numeric_limits<float>::max()) {
+		buffer.reservoirs[i] = own;
+		return;
+	}
+	int x = i%buffer.w;
+	int y = i/buffer.w;
+	Sampler& sampler = Sampler::get();
+	sampler.start(x, y, buffer.frame);
+	Seed(buffer, x, y, 1);
+	sampler.reserve(3); // the candidate pass's dimensions
+	uint32_t dimension = sampler.reserve(2);
+	int count = std::min(buffer.neighbours, MAX_NEIGHBOURS);
+
+	// SPATIAL REUSE
+	// neighbours are re-targeted here but their visibility is taken as is, so this is only
+	// unbiased away from shadow edges
+	Source sources[MAX_NEIGHBOURS + 1];
+	sources[0] = { &own, p, n, own.M };
+	int reused = 1;
+	for (int k = 0; k < count; k++) {
+		glm::vec2 u = sampler.get2D(dimension, k, count);
+		float r = buffer.radius * std::sqrt(u.x);
+		float phi = 2.0f * M_PI * u.y;
+		int nx = x + (int)std::round(r * std::cos(phi));
+		int ny = y + (int)std::round(r * std::sin(phi));
+		if (nx < 0 || ny < 0 || nx >= buffer.w || ny >= buffer.h || (nx == x && ny == y)) continue;
+		size_t j = ny*buffer.w + nx;
+		if (!similar(n, p, gbuffer.normals[j], gbuffer.positions[j], scene.camera.position)) continue;
+		sources[reused++] = { &buffer.initial[j], gbuffer.positions[j], gbuffer.normals[j], buffer.initial[j].M };
+	}
+	buffer.reservoirs[i] = Combine(sources, reused, scene);
+}
+
+void ReSTIRUtils::advance(ReservoirBuffer& buffer, const DenoiseBuffer& gbuffer) {
+	buffer.previous = buffer.reservoirs;
+	buffer.normals = gbuffer.normals;
+	buffer.positions = gbuffer.positions;
+	buffer.frame++;
+}
+
+float ReSTIRUtils::target(const Scene& scene, int light, const glm::vec3& y, const glm::vec3& ny, const glm::vec3& p, const glm::vec3& n) {
+	// unshadowed diffuse contribution of point y on a light, per unit area of the light
+	glm::vec3 d = y - p;
+	float dist2 = glm::dot(d, d);
+	if (dist2 <= 0.0f) return 0.0f;
+	glm::vec3 dir = d / std::sqrt(dist2);
+	float cosTheta = glm::dot(n, dir);
+	float cosLight = -glm::dot(ny, dir);
+	if (cosTheta <= 0.0f || cosLight <= 0.0f) return 0.0f;
+	return scene.lightGeometry[light].emission * cosTheta * cosLight / dist2;
+}
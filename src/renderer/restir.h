@@ -0,0 +1,30 @@
+#pragma once
+
+#include "scene/scene.h"
+#include "renderer/denoise.h"
+#include <vector>
+
+struct ReservoirBuffer {
+	std::vector<Reservoir> initial;    // candidates and temporal reuse, before spatial reuse
+	std::vector<Reservoir> reservoirs; // what shading reads
+	std::vector<Reservoir> previous;   // last frame's reservoirs and the g-buffer they were made for
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> positions;
+	size_t w = 0;
+	size_t h = 0;
+	int frame = 0;
+	int candidates = 32;
+	int neighbours = 5;
+	float radius = 10.0f;   // spatial reuse radius in pixels
+	float history = 20.0f;  // temporal samples count for at most this many times the candidates
+};
+
+namespace ReSTIRUtils {
+	ReservoirBuffer generateBuffer(size_t w, size_t h);
+	void sampleAtIndex(ReservoirBuffer& buffer, const Scene& scene, const DenoiseBuffer& gbuffer, size_t index);
+	void resampleAtIndex(ReservoirBuffer& buffer, const Scene& scene, const DenoiseBuffer& gbuffer, size_t index);
+	void advance(ReservoirBuffer& buffer, const DenoiseBuffer& gbuffer);
+	float target(const Scene& scene, int light, const glm::vec3& y, const glm::vec3& ny, const glm::vec3& p, const glm::vec3& n);
+	// whether two g-buffer points lie on the same surface, judged by normal and distance to the eye
+	bool similar(const glm::vec3& n1, const glm::vec3& p1, const glm::vec3& n2, const glm::vec3& p2, const glm::vec3& eye);
+};
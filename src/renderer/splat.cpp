@@ -0,0 +1,31 @@
+#include "splat.h"
+#include <algorithm>
+
+void Add(std::atomic<float>& channel, float v) {
+	float current = channel.load(std::memory_order_relaxed);
+	while (!channel.compare_exchange_weak(current, current + v, std::memory_order_relaxed));
+}
+
+SplatBuffer SplatUtils::generateBuffer(size_t w, size_t h) {
+	SplatBuffer buffer{};
+	buffer.w = w;
+	buffer.h = h;
+	buffer.channels.reset(new std::atomic<float>[w*h*3]);
+	for (size_t i = 0; i < w*h*3; i++) buffer.channels[i].store(0.0f, std::memory_order_relaxed);
+	return buffer;
+}
+
+void SplatUtils::splat(SplatBuffer& buffer, const glm::vec2& raster, const glm::vec3& c) {
+	size_t x = std::min((size_t)raster.x, buffer.w - 1);
+	size_t y = std::min((size_t)raster.y, buffer.h - 1);
+	size_t i = (y * buffer.w + x) * 3;
+	for (int k = 0; k < 3; k++) if (c[k] != 0.0f) Add(buffer.channels[i + k], c[k]);
+}
+
+void SplatUtils::resolve(const SplatBuffer& buffer, Image& image, float scale) {
+	// the threads that splatted have all been joined, so plain loads see every update
+	for (size_t i = 0; i < buffer.w * buffer.h; i++) {
+		glm::vec3 c = glm::vec3(buffer.channels[i*3].load(), buffer.channels[i*3 + 1].load(), buffer.channels[i*3 + 2].load());
+		image.colors[i] += c * scale;
+	}
+}
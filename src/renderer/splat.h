@@ -0,0 +1,21 @@
+#pragma once
+
+#include "renderer/image.h"
+#include <glm/glm.hpp>
+#include <atomic>
+#include <memory>
+
+// an image every thread can add to at once, for contributions that land on pixels other than the
+// one being rendered. each channel is updated with a compare and swap, so a splat never waits on
+// a lock and never loses a concurrent one
+struct SplatBuffer {
+	std::unique_ptr<std::atomic<float>[]> channels; // three per pixel
+	size_t w = 0;
+	size_t h = 0;
+};
+
+namespace SplatUtils {
+	SplatBuffer generateBuffer(size_t w, size_t h);
+	void splat(SplatBuffer& buffer, const glm::vec2& raster, const glm::vec3& c);
+	void resolve(const SplatBuffer& buffer, Image& image, float scale);
+};
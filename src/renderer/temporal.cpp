@@ -0,0 +1,70 @@
+#include "temporal.h"
+#include <limits>
+#include <cmath>
+
+TemporalBuffer TemporalUtils::generateBuffer(size_t w, size_t h) {
+	TemporalBuffer buffer{};
+	buffer.w = w;
+	buffer.h = h;
+	buffer.counts.assign(w*h, 1.0f);
+	return buffer;
+}
+
+void TemporalUtils::accumulateAtIndex(TemporalBuffer& buffer, const DenoiseBuffer& gbuffer, Image& image, size_t i) {
+	buffer.counts[i] = 1.0f;
+	glm::vec3 p = gbuffer.positions[i];
+	if (buffer.colors.size() != buffer.w*buffer.h || p.x == std::numeric_limits<float>::max()) return;
+
+	// REPROJECTION
+	// where the surface was a frame ago, and which pixel of the last frame saw it there. the motion
+	// is rigid, so normals go back through it unchanged in length
+	glm::mat4 back = glm::inverse(buffer.motion);
+	glm::vec3 q = glm::vec3(back * glm::vec4(p, 1.0f));
+	glm::vec3 n = glm::mat3(back) * gbuffer.normals[i];
+	glm::vec2 raster;
+	float pdf;
+	if (!buffer.camera.project(q, raster, pdf)) return;
+	float d = glm::length(q - buffer.camera.position);
+
+	// bilinear over the four pixels around it, leaving out any that saw another surface
+	int x0 = (int)std::floor(raster.x);
+	int y0 = (int)std::floor(raster.y);
+	float fx = raster.x - x0;
+	float fy = raster.y - y0;
+	glm::vec3 color = glm::vec3(0.0f);
+	float frames = 0.0f;
+	float total = 0.0f;
+	for (int k = 0; k < 4; k++) {
+		int x = x0 + (k & 1);
+		int y = y0 + (k >> 1);
+		float w = ((k & 1) ? fx : 1.0f - fx) * ((k >> 1) ? fy : 1.0f - fy);
+		if (w <= 0.0f || x < 0 || y < 0 || x >= buffer.w || y >= buffer.h) continue;
+		size_t j = y*buffer.w + x;
+		const glm::vec3& pj = buffer.positions[j];
+		if (pj.x == std::numeric_limits<float>::max()) continue;
+		if (glm::dot(n, buffer.normals[j]) < buffer.normal) continue;
+		if (std::abs(glm::length(pj - buffer.camera.position) - d) > buffer.depth * d) continue;
+		color += w * buffer.colors[j];
+		frames += w * buffer.frames[j];
+		total += w;
+	}
+	if (total <= 0.0f) return;
+	color /= total;
+	frames /= total;
+
+	// ACCUMULATION
+	// a running mean over the frames the history stands for, capped so it keeps following the
+	// lighting as surfaces turn under it
+	float count = std::min(frames + 1.0f, buffer.history);
+	image.colors[i] = color + (image.colors[i] - color) / count;
+	buffer.counts[i] = count;
+}
+
+void TemporalUtils::advance(TemporalBuffer& buffer, const Scene& scene, const DenoiseBuffer& gbuffer, const Image& image) {
+	buffer.colors = image.colors;
+	buffer.frames = buffer.counts;
+	buffer.normals = gbuffer.normals;
+	buffer.positions = gbuffer.positions;
+	buffer.camera = scene.camera;
+	buffer.motion = glm::mat4(1.0f);
+}
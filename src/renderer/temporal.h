@@ -0,0 +1,30 @@
+#pragma once
+
+#include "scene/scene.h"
+#include "renderer/denoise.h"
+#include "renderer/image.h"
+#include <vector>
+
+// what earlier frames of an animation converged to, with the g-buffer and camera they were seen
+// through. each frame follows its surfaces back through how the scene moved, keeps whatever
+// history still shows the same surface and averages its own samples into it
+struct TemporalBuffer {
+	std::vector<glm::vec3> colors;    // accumulated, as of the last frame
+	std::vector<float> frames;        // how many frames each pixel's colour averages
+	std::vector<float> counts;        // the same for the frame being accumulated
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> positions;
+	Camera camera;
+	glm::mat4 motion = glm::mat4(1.0f); // how the scene moved since the last frame
+	size_t w = 0;
+	size_t h = 0;
+	float history = 16.0f; // frames the history counts for at most, more converges further but lags
+	float normal = 0.9f;   // least cosine between the normals of a reused surface
+	float depth = 0.1f;    // most a reused surface's distance to the camera may differ, as a share of it
+};
+
+namespace TemporalUtils {
+	TemporalBuffer generateBuffer(size_t w, size_t h);
+	void accumulateAtIndex(TemporalBuffer& buffer, const DenoiseBuffer& gbuffer, Image& image, size_t index);
+	void advance(TemporalBuffer& buffer, const Scene& scene, const DenoiseBuffer& gbuffer, const Image& image);
+};
@@ -0,0 +1,96 @@
+#include "tiles.h"
+#include <algorithm>
+
+static inline uint64_t pack(uint32_t first, uint32_t end) {
+	return ((uint64_t)first << 32) | end;
+}
+
+static inline uint32_t spread(uint32_t v) {
+	// the low 16 bits of v moved to the even bits
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+TileSchedule TileUtils::generateSchedule(size_t w, size_t h, size_t workers) {
+	TileSchedule schedule{};
+	schedule.w = w;
+	schedule.h = h;
+	schedule.workers = std::max((size_t)1, workers);
+	schedule.columns = (w + TILE_SIZE - 1) / TILE_SIZE;
+	size_t rows = (h + TILE_SIZE - 1) / TILE_SIZE;
+
+	// ORDER
+	// along a z curve, so neighbouring tiles, and with them the geometry and textures they touch,
+	// are rendered close together in time, and each worker's share is a compact patch of the image
+	schedule.tiles.resize(schedule.columns * rows);
+	for (size_t i = 0; i < schedule.tiles.size(); i++) schedule.tiles[i] = i;
+	std::vector<uint32_t> codes(schedule.tiles.size());
+	for (size_t i = 0; i < codes.size(); i++) codes[i] = spread(i % schedule.columns) | (spread(i / schedule.columns) << 1);
+	std::sort(schedule.tiles.begin(), schedule.tiles.end(), [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+
+	// every worker starts with an even run of the curve
+	size_t count = schedule.tiles.size();
+	schedule.queues.reset(new TileQueue[schedule.workers]);
+	for (size_t i = 0; i < schedule.workers; i++) {
+		size_t first = i * (count / schedule.workers) + std::min(i, count % schedule.workers);
+		size_t end = first + count / schedule.workers + (i < count % schedule.workers ? 1 : 0);
+		schedule.queues[i].range.store(pack(first, end), std::memory_order_relaxed);
+	}
+	return schedule;
+}
+
+bool TileUtils::next(TileSchedule& schedule, size_t worker, uint32_t& tile) {
+	TileQueue& own = schedule.queues[worker];
+	uint64_t range = own.range.load(std::memory_order_acquire);
+	while ((uint32_t)(range >> 32) < (uint32_t)range) {
+		uint32_t first = range >> 32;
+		if (own.range.compare_exchange_weak(range, pack(first + 1, (uint32_t)range), std::memory_order_acq_rel)) {
+			tile = schedule.tiles[first];
+			return true;
+		}
+	}
+
+	// STEALING
+	// the rest of the curve round from this worker, so thieves spread over different victims. a
+	// stolen half is taken from the far end of the victim's run and becomes this worker's own queue,
+	// which nobody else touches while it is empty. a worker that finds nothing is done, whatever is
+	// still in flight gets rendered by whoever took it
+	for (size_t k = 1; k < schedule.workers; k++) {
+		TileQueue& victim = schedule.queues[(worker + k) % schedule.workers];
+		range = victim.range.load(std::memory_order_acquire);
+		while ((uint32_t)(range >> 32) < (uint32_t)range) {
+			uint32_t first = range >> 32;
+			uint32_t end = range;
+			uint32_t split = end - (end - first + 1) / 2;
+			if (!victim.range.compare_exchange_weak(range, pack(first, split), std::memory_order_acq_rel)) continue;
+			own.range.store(pack(split + 1, end), std::memory_order_release);
+			tile = schedule.tiles[split];
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileUtils::bounds(const TileSchedule& schedule, uint32_t tile, size_t& x0, size_t& y0, size_t& x1, size_t& y1) {
+	x0 = (tile % schedule.columns) * TILE_SIZE;
+	y0 = (tile / schedule.columns) * TILE_SIZE;
+	x1 = std::min(x0 + TILE_SIZE, schedule.w);
+	y1 = std::min(y0 + TILE_SIZE, schedule.h);
+}
+
+std::unique_ptr<WorkerProgress[]> TileUtils::generateProgress(size_t workers) {
+	std::unique_ptr<WorkerProgress[]> progress(new WorkerProgress[workers]);
+	for (size_t i = 0; i < workers; i++) progress[i].done.store(0, std::memory_order_relaxed);
+	return progress;
+}
+
+int TileUtils::progress(const WorkerProgress* progress, size_t workers) {
+	// a report only has to be close, so the counters are read without ordering
+	int done = 0;
+	for (size_t i = 0; i < workers; i++) done += progress[i].done.load(std::memory_order_relaxed);
+	return done;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#define TILE_SIZE 16 // pixels along each side of a tile
+
+// one worker's share of the tiles, a range of positions in the ordered list. the owner takes
+// tiles from the front, a worker that ran out steals half of what is left from the back. both swap
+// the packed range whole, so neither waits on a lock, and since the list never changes a range that
+// reads the same is the same work
+struct alignas(64) TileQueue {
+	std::atomic<uint64_t> range; // first position in the high half, one past the last in the low
+};
+
+// what one worker has finished, on a cache line of its own so workers never write to a shared one
+struct alignas(64) WorkerProgress {
+	std::atomic<int> done;
+};
+
+struct TileSchedule {
+	std::vector<uint32_t> tiles; // tiles, numbered row by row, sorted along a z curve
+	std::unique_ptr<TileQueue[]> queues; // one per worker
+	size_t workers = 0;
+	size_t columns = 0; // tiles across the image
+	size_t w = 0;
+	size_t h = 0;
+};
+
+namespace TileUtils {
+	TileSchedule generateSchedule(size_t w, size_t h, size_t workers);
+	// the next tile for worker, its own or a stolen one, false once there is none left anywhere
+	bool next(TileSchedule& schedule, size_t worker, uint32_t& tile);
+	void bounds(const TileSchedule& schedule, uint32_t tile, size_t& x0, size_t& y0, size_t& x1, size_t& y1);
+	std::unique_ptr<WorkerProgress[]> generateProgress(size_t workers);
+	int progress(const WorkerProgress* progress, size_t workers);
+};
@@ -0,0 +1,168 @@
+#include "wavefront.h"
+#include "scene/material.h"
+#include <algorithm>
+
+WavefrontBuffer WavefrontUtils::generateBuffer(size_t capacity, size_t samples, size_t workers) {
+	WavefrontBuffer buffer{};
+	buffer.capacity = capacity;
+	buffer.samples = samples;
+	buffer.rays.resize(capacity);
+	buffer.hits.resize(capacity);
+	buffer.media.resize(capacity);
+	buffer.depths.resize(capacity);
+	buffer.roulette.resize(capacity);
+	buffer.specular.resize(capacity);
+	buffer.diffuse.resize(capacity);
+	buffer.pdfs.resize(capacity);
+	buffer.bins.resize(capacity * NMSAMPLES);
+	buffer.radiance.resize(capacity);
+	buffer.states.resize(capacity);
+	buffer.active.resize(capacity);
+	buffer.order.resize(capacity);
+	buffer.kinds.resize(capacity);
+	buffer.alive.resize(capacity);
+	buffer.survivors.assign(workers, 0);
+	buffer.histograms.assign(workers * WAVEFRONT_KINDS, 0);
+	buffer.shadows.resize(workers);
+	return buffer;
+}
+
+void WavefrontUtils::generate(WavefrontBuffer& buffer, const Scene& scene, size_t start, size_t count) {
+	// camera rays drawn exactly as the megakernel draws them, so both trace the same paths
+	Sampler& sampler = Sampler::get();
+	for (size_t i = start; i < start + count; i++) {
+		size_t pixel = buffer.first + i / buffer.samples;
+		size_t x = pixel % scene.camera.width;
+		size_t y = pixel / scene.camera.width;
+		sampler.start(x, y, i % buffer.samples);
+		glm::vec2 offset = sampler.get2D();
+		Ray ray = scene.camera.generateRay(x, y, offset.x, offset.y);
+		buffer.rays[i] = ray;
+		buffer.media[i] = (Medium){ 1.0f, 0, MaterialUtils::AirMaterial(), Spectrum(1.0f), NMSAMPLES, ray.p };
+		buffer.depths[i] = 0;
+		buffer.roulette[i] = false;
+		buffer.specular[i] = true;
+		buffer.diffuse[i] = false;
+		buffer.pdfs[i] = 0.0f;
+		for (int j = 0; j < NMSAMPLES; j++) buffer.bins[i * NMSAMPLES + j] = j;
+		buffer.radiance[i] = Spectrum(0.0f);
+		buffer.states[i] = sampler.save();
+		// so the share compacts into the first queue as if the worker had just shaded it
+		buffer.order[i] = i;
+		buffer.alive[i] = true;
+	}
+}
+
+size_t WavefrontUtils::remaining(const WavefrontBuffer& buffer) {
+	size_t total = 0;
+	for (size_t n : buffer.survivors) total += n;
+	return total;
+}
+
+void WavefrontUtils::count(WavefrontBuffer& buffer, size_t worker, size_t start, size_t count) {
+	// over the share of the sorted paths the worker shaded, whose flags only it has written
+	size_t n = 0;
+	for (size_t k = start; k < start + count; k++) n += buffer.alive[buffer.order[k]];
+	buffer.survivors[worker] = n;
+}
+
+void WavefrontUtils::compact(WavefrontBuffer& buffer, size_t worker, size_t& start, size_t& count) {
+	// the surviving paths of the worker's share go after those of every worker before it, so
+	// the queue comes out as one serial pass over the sorted paths would leave it. start and
+	// count move from the share of the sorted paths to the run of active paths it became
+	size_t offset = 0;
+	for (size_t w = 0; w < worker; w++) offset += buffer.survivors[w];
+	size_t next = offset;
+	for (size_t k = start; k < start + count; k++) {
+		uint32_t i = buffer.order[k];
+		if (buffer.alive[i]) buffer.active[next++] = i;
+	}
+	start = offset;
+	count = next - offset;
+}
+
+void WavefrontUtils::histogram(WavefrontBuffer& buffer, size_t worker, size_t start, size_t count) {
+	size_t* counts = &buffer.histograms[worker * WAVEFRONT_KINDS];
+	for (int k = 0; k < WAVEFRONT_KINDS; k++) counts[k] = 0;
+	for (size_t k = start; k < start + count; k++) counts[buffer.kinds[buffer.active[k]]]++;
+}
+
+void WavefrontUtils::sort(WavefrontBuffer& buffer, size_t worker, size_t start, size_t count) {
+	// counting sort, so every kind of vertex is shaded in one run and paths keep their order within
+	// it. each worker places its own run of active paths after every kind before theirs and after
+	// the same kind from the workers before it
+	size_t workers = buffer.survivors.size();
+	size_t offsets[WAVEFRONT_KINDS] = { 0 };
+	size_t base = 0;
+	for (int k = 0; k < WAVEFRONT_KINDS; k++) {
+		for (size_t w = 0; w < workers; w++) {
+			if (w == worker) offsets[k] = base;
+			base += buffer.histograms[w * WAVEFRONT_KINDS + k];
+		}
+	}
+	for (size_t k = start; k < start + count; k++) {
+		uint32_t i = buffer.active[k];
+		buffer.order[offsets[buffer.kinds[i]]++] = i;
+	}
+}
+
+void WavefrontUtils::queue(ShadowQueue& queue, uint32_t path, VertexLight& light) {
+	// moves what a vertex sampled to the back of the queue, leaving light empty for the next vertex
+	if (light.stream.count == 0 && !light.pending) return;
+	queue.paths.push_back(path);
+	queue.bins.insert(queue.bins.end(), light.bins, light.bins + NMSAMPLES);
+	queue.attenuated.push_back(light.attenuated);
+	queue.origins.push_back(light.stream.p);
+	for (int i = 0; i < light.stream.count; i++) {
+		queue.directions.push_back(light.stream.d[i]);
+		queue.distances.push_back(light.stream.dist[i]);
+		queue.shaded.push_back(light.shaded[i]);
+	}
+	queue.ends.push_back((uint32_t)queue.directions.size());
+	queue.emitters.push_back(light.pending ? (int)queue.rays.size() : -1);
+	if (light.pending) {
+		queue.rays.push_back(light.emitter);
+		queue.limits.push_back(light.limit);
+		queue.emitted.push_back(light.emitted);
+	}
+	light.stream.count = 0;
+	light.pending = false;
+}
+
+void WavefrontUtils::clear(ShadowQueue& queue) {
+	// keeps the storage, which grows to the most any round of the worker's emitted
+	queue.paths.clear();
+	queue.bins.clear();
+	queue.attenuated.clear();
+	queue.origins.clear();
+	queue.ends.clear();
+	queue.emitters.clear();
+	queue.directions.clear();
+	queue.distances.clear();
+	queue.shaded.clear();
+	queue.rays.clear();
+	queue.limits.clear();
+	queue.emitted.clear();
+}
+
+void WavefrontUtils::resolve(const WavefrontBuffer& buffer, Image& image, size_t start, size_t count) {
+	// samples are summed in order, as the megakernel sums them
+	for (size_t p = start; p < start + count; p++) {
+		Spectrum s = Spectrum(0.0f);
+		for (size_t n = 0; n < buffer.samples; n++) s += buffer.radiance[p * buffer.samples + n];
+		image.colors[buffer.first + p] = (s / float(buffer.samples)).rgb();
+	}
+}
+
+void WavefrontUtils::wait(WavefrontBarrier& barrier) {
+	// the last worker to arrive lets the round go, the lock orders whatever was written before it
+	std::unique_lock<std::mutex> lock(barrier.mutex);
+	size_t round = barrier.round;
+	if (++barrier.waiting == barrier.workers) {
+		barrier.waiting = 0;
+		barrier.round++;
+		barrier.released.notify_all();
+		return;
+	}
+	barrier.released.wait(lock, [&] { return barrier.round != round; });
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "scene/scene.h"
+#include "renderer/image.h"
+#include "util/sampler.h"
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// kinds of vertex the shade stage runs together, in the order the paths are sorted into
+enum WavefrontKind {
+    WAVEFRONT_MISS,
+    WAVEFRONT_EMISSIVE,
+    WAVEFRONT_LAMBERTIAN,
+    WAVEFRONT_DIELECTRIC,
+    WAVEFRONT_VOLUMETRIC,
+    WAVEFRONT_KINDS
+};
+
+// the shadow rays one worker's share of the shade stage emitted, one array per field and only as
+// long as what was emitted. a vertex's light samples stay together, so they are still traced as
+// one stream, and every vertex's rays are tested in the order gatherLight() tests them
+struct ShadowQueue {
+    // VERTICES, one per shaded vertex that sampled any light
+    std::vector<uint32_t> paths;
+    std::vector<int> bins;           // NMSAMPLES per vertex
+    std::vector<uint8_t> attenuated; // weighted by the volumes its rays pass through
+    std::vector<glm::vec3> origins;  // of its light sample rays
+    std::vector<uint32_t> ends;      // one past its last light sample ray
+    std::vector<int> emitters;       // its emitter sample, or -1
+
+    // LIGHT SAMPLES
+    std::vector<glm::vec3> directions;
+    std::vector<float> distances;
+    std::vector<Spectrum> shaded;    // what each adds if nothing blocks it
+
+    // EMITTER SAMPLES
+    std::vector<Ray> rays;
+    std::vector<float> limits;       // anything hit closer than this blocks the sample
+    std::vector<Spectrum> emitted;
+};
+
+// every path of a batch of pixels, one array per field, so each stage streams through only the
+// fields it needs. path i of the batch is sample i % samples of pixel first + i / samples
+struct WavefrontBuffer {
+    size_t capacity = 0;
+    size_t samples = 0; // per pixel
+    size_t first = 0;   // pixel the batch starts at
+    size_t pixels = 0;  // in the batch
+
+    // PATHS
+    std::vector<Ray> rays;
+    std::vector<Hit> hits;
+    std::vector<Medium> media;
+    std::vector<int> depths;
+    std::vector<uint8_t> roulette;
+    std::vector<uint8_t> specular;
+    std::vector<uint8_t> diffuse;
+    std::vector<float> pdfs;
+    std::vector<int> bins;           // NMSAMPLES per path
+    std::vector<Spectrum> radiance;
+    std::vector<SamplerState> states;
+
+    // QUEUES
+    std::vector<uint32_t> active;    // paths that still have a ray to trace, each worker's in a run
+    std::vector<uint32_t> order;     // the active paths grouped by kind
+    std::vector<uint8_t> kinds;
+    std::vector<uint8_t> alive;      // whether the shade stage extended the path
+
+    // WORKERS
+    // what each worker counted over its share, so every worker can work out where its own
+    // share of the next queue starts without a serial step
+    std::vector<size_t> survivors;   // paths the worker's share of the shade stage extended
+    std::vector<size_t> histograms;  // WAVEFRONT_KINDS per worker, of its run of active paths
+    std::vector<ShadowQueue> shadows;
+};
+
+// where the workers of the wavefront meet between stages, so none reads a queue before every
+// other worker has finished writing its share
+struct WavefrontBarrier {
+    std::mutex mutex;
+    std::condition_variable released;
+    size_t workers = 0;
+    size_t waiting = 0;
+    size_t round = 0; // how many times every worker has met here
+};
+
+namespace WavefrontUtils {
+    WavefrontBuffer generateBuffer(size_t capacity, size_t samples, size_t workers);
+    void generate(WavefrontBuffer& buffer, const Scene& scene, size_t start, size_t count);
+    size_t remaining(const WavefrontBuffer& buffer); // paths left, read after the counting barrier and before the next
+    void count(WavefrontBuffer& buffer, size_t worker, size_t start, size_t count);
+    void compact(WavefrontBuffer& buffer, size_t worker, size_t& start, size_t& count);
+    void histogram(WavefrontBuffer& buffer, size_t worker, size_t start, size_t count);
+    void sort(WavefrontBuffer& buffer, size_t worker, size_t start, size_t count);
+    void queue(ShadowQueue& queue, uint32_t path, VertexLight& light);
+    void clear(ShadowQueue& queue);
+    void resolve(const WavefrontBuffer& buffer, Image& image, size_t start, size_t count);
+    void wait(WavefrontBarrier& barrier);
+};
@@ -0,0 +1,127 @@
+#include "bdpt.h"
+#include "scene/scene.h"
+#include <cmath>
+
+float Remap(float pdf) {
+    // delta events have no density, they are skipped when the ratios are summed
+    return pdf != 0.0f ? pdf : 1.0f;
+}
+
+float Directional(const PathVertex& v, const glm::vec3& w) {
+    // lights emit from their outer side only, emissive primitives from both
+    float cosTheta = glm::dot(v.n, w);
+    if (v.source >= 0) return cosTheta > 0.0f ? cosTheta / M_PI : 0.0f;
+    return std::abs(cosTheta) / (2.0f * M_PI);
+}
+
+float Bidirectional::convert(float pdf, const PathVertex& from, const PathVertex& to) {
+    // solid angle at from to area at to, the camera is a point and has no surface to project onto
+    glm::vec3 w = to.p - from.p;
+    float dist2 = glm::dot(w, w);
+    if (dist2 <= 0.0f) return 0.0f;
+    if (to.type != CAMERA_VERTEX) pdf *= std::abs(glm::dot(to.n, w)) / std::sqrt(dist2);
+    return pdf / dist2;
+}
+
+float Bidirectional::pdf(const Scene& scene, const PathVertex& v, const PathVertex& next) {
+    // density of v sampling next. surfaces along a subpath sample the cosine, so it does not
+    // matter which way the path reached v
+    glm::vec3 w = glm::normalize(next.p - v.p);
+    if (v.type == CAMERA_VERTEX) {
+        glm::vec2 raster;
+        float density;
+        return scene.camera.project(next.p, raster, density) ? convert(density, v, next) : 0.0f;
+    }
+    if (v.type == LIGHT_VERTEX) return convert(Directional(v, w), v, next);
+    float cosTheta = glm::dot(v.n, w);
+    if (v.delta || cosTheta <= 0.0f) return 0.0f;
+    return convert(cosTheta / M_PI, v, next);
+}
+
+float Bidirectional::origin(const Scene& scene, const PathVertex& v) {
+    // density of a light subpath starting at v, the source is picked by flux and the point
+    // uniformly over its surface. sphere lights are sampled on the proxy cameras see them as
+    if (scene.photonFlux <= 0.0f) return 0.0f;
+    if (v.source >= 0) {
+        const Light& light = scene.lights[v.source];
+        const LightGeometry& geometry = scene.lightGeometry[v.source];
+        float area = geometry.area;
+        if (light.radius > 0.0f) {
+            float r = scene.lPrimitive[proxy(scene, v.source)].v2.x;
+            area = 4.0f * M_PI * r * r;
+        }
+        return M_PI * geometry.area * geometry.emission / (scene.photonFlux * area);
+    }
+    Spectrum e = Spectrum(scene.materials[-1 - v.source].emission());
+    float mean = 0.0f;
+    for (int j = 0; j < NMSAMPLES; j++) mean += std::max(0.0f, e[j]) / NMSAMPLES;
+    return 2.0f * M_PI * mean / scene.photonFlux;
+}
+
+Spectrum Bidirectional::emission(const Scene& scene, const PathVertex& v, const glm::vec3& w) {
+    if (v.source < 0) return Spectrum(scene.materials[-1 - v.source].emission());
+    return glm::dot(v.n, w) > 0.0f ? Spectrum(scene.lights[v.source].color) : Spectrum(0.0f);
+}
+
+Spectrum Bidirectional::reflectance(const Material& m, float cosLight, bool lit) {
+    // where light from one of the scene's lights first lands it is shaded with the material's
+    // diffuse term, as the path tracer's light samples and photons are
+    if (lit) return Spectrum(m.diffuse().evaluate(cosLight) / (cosLight * M_PI));
+    return Spectrum(m.absorb()) / M_PI;
+}
+
+int Bidirectional::proxy(const Scene& scene, int light) {
+    // every sphere light is given a proxy, in the order they were parsed
+    int index = 0;
+    for (int i = 0; i < light; i++) if (scene.lights[i].radius > 0.0f) index++;
+    return index;
+}
+
+int Bidirectional::light(const Scene& scene, const glm::vec3& p) {
+    // the sphere light whose proxy p lies on
+    int best = -1;
+    int index = 0;
+    float closest = 0.0f;
+    for (int i = 0; i < scene.lights.size(); i++) {
+        if (scene.lights[i].radius <= 0.0f) continue;
+        const Primitive& sphere = scene.lPrimitive[index++];
+        float gap = std::abs(glm::length(p - sphere.v1) - sphere.v2.x);
+        if (best < 0 || gap < closest) {
+            best = i;
+            closest = gap;
+        }
+    }
+    return best;
+}
+
+float Bidirectional::weight(const Scene& scene, const PathVertex* light, int s, const PathVertex* camera, int t) {
+    // power heuristic over every way the same path could have been split between the subpaths.
+    // each step along a subpath swaps one forward density for a reverse one, only the four
+    // densities next to the connection depend on it and are worked out here
+    if (s + t == 2) return 1.0f;
+    const PathVertex* qs = s > 0 ? &light[s - 1] : nullptr;
+    const PathVertex* qsMinus = s > 1 ? &light[s - 2] : nullptr;
+    const PathVertex& pt = camera[t - 1];
+    const PathVertex* ptMinus = t > 1 ? &camera[t - 2] : nullptr;
+    float ptRev = qs ? pdf(scene, *qs, pt) : origin(scene, pt);
+    float ptMinusRev = ptMinus ? (qs ? pdf(scene, pt, *ptMinus) : convert(Directional(pt, glm::normalize(ptMinus->p - pt.p)), pt, *ptMinus)) : 0.0f;
+    float qsRev = qs ? pdf(scene, pt, *qs) : 0.0f;
+    float qsMinusRev = qsMinus ? pdf(scene, *qs, *qsMinus) : 0.0f;
+
+    float sum = 0.0f;
+    float r = 1.0f;
+    for (int i = t - 1; i > 0; i--) {
+        float rev = i == t - 1 ? ptRev : (i == t - 2 ? ptMinusRev : camera[i].pdfRev);
+        float ratio = Remap(rev) / Remap(camera[i].pdfFwd);
+        r *= ratio * ratio;
+        if (!camera[i].delta && !camera[i - 1].delta) sum += r;
+    }
+    r = 1.0f;
+    for (int i = s - 1; i >= 0; i--) {
+        float rev = i == s - 1 ? qsRev : (i == s - 2 ? qsMinusRev : light[i].pdfRev);
+        float ratio = Remap(rev) / Remap(light[i].pdfFwd);
+        r *= ratio * ratio;
+        if (!light[i].delta && (i == 0 || !light[i - 1].delta)) sum += r;
+    }
+    return 1.0f / (1.0f + sum);
+}
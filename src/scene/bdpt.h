@@ -0,0 +1,43 @@
+#pragma once
+
+#include "scene/spectrum.h"
+#include "scene/material.h"
+#include <glm/glm.hpp>
+
+#define BDPT_DEPTH 32 // bounces either subpath can take, roulette has ended nearly every path by then
+
+struct Scene;
+
+enum VertexType {
+    CAMERA_VERTEX,
+    LIGHT_VERTEX,  // where a light subpath starts, or an emitter a camera subpath ran into
+    SURFACE_VERTEX
+};
+
+// a vertex of a camera or light subpath. pdfs are per unit area at the vertex, forward for the
+// direction its subpath was traced in and reverse for a subpath traced from the other end
+struct PathVertex {
+    VertexType type;
+    glm::vec3 p;
+    glm::vec3 n;             // facing the side the vertex was reached from, outwards on lights
+    Spectrum beta;           // throughput of the subpath up to the vertex
+    Spectrum lit;            // camera subpaths: beta had the last diffuse bounce been lit by a light
+    const Material* material;
+    int source;              // light vertices: light index, or -1 - material for emissive primitives
+    bool delta;
+    bool first;              // light subpaths from a light: the first diffuse vertex
+    bool isolated;           // a diffracting dielectric left only the hero wavelength
+    float pdfFwd;
+    float pdfRev;
+};
+
+namespace Bidirectional {
+    float convert(float pdf, const PathVertex& from, const PathVertex& to);
+    float pdf(const Scene& scene, const PathVertex& v, const PathVertex& next);
+    float origin(const Scene& scene, const PathVertex& v);
+    Spectrum emission(const Scene& scene, const PathVertex& v, const glm::vec3& w);
+    Spectrum reflectance(const Material& m, float cosLight, bool lit);
+    int proxy(const Scene& scene, int light);
+    int light(const Scene& scene, const glm::vec3& p);
+    float weight(const Scene& scene, const PathVertex* light, int s, const PathVertex* camera, int t);
+};
@@ -3,6 +3,7 @@
 #include "scene/primitives.h"
 #include "scene/ray.h"
 #include "scene/aabb.h"
+#include <algorithm>
 #include <vector>
 
 enum BranchBVH {
@@ -23,4 +24,17 @@ struct NodeBVH {
 namespace BVH {
     std::vector<NodeBVH> create(const std::vector<Primitive>& primitives);
     bool intersect(const Ray& ray, size_t ind, const std::vector<NodeBVH>& bvh);
+
+    // the same test inline, for traversal, with the ray's inverse direction worked out once per ray
+    inline bool intersect(const Ray& ray, const glm::vec3& dfrac, const NodeBVH& node) {
+        float t1 = (node.min.x - ray.p.x)*dfrac.x;
+        float t2 = (node.max.x - ray.p.x)*dfrac.x;
+        float t3 = (node.min.y - ray.p.y)*dfrac.y;
+        float t4 = (node.max.y - ray.p.y)*dfrac.y;
+        float t5 = (node.min.z - ray.p.z)*dfrac.z;
+        float t6 = (node.max.z - ray.p.z)*dfrac.z;
+        float tmin = std::max(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
+        float tmax = std::min(std::min(std::max(t1, t2), std::max(t3, t4)), std::max(t5, t6));
+        return !(tmax < 0 || tmin > tmax);
+    }
 }
@@ -0,0 +1,98 @@
+#include "cache.h"
+#include <algorithm>
+#include <cmath>
+
+#define CACHE_PROBES 16      // slots tried past the one a key hashes to
+#define CACHE_MIN_SAMPLES 8  // records a cell needs before paths trust it
+
+uint64_t Key(const glm::vec3& p, const glm::vec3& n, float cell) {
+    // 20 bits per axis around the origin and the face the normal points at, never 0
+    glm::ivec3 c = glm::clamp(glm::ivec3(glm::floor(p / cell)) + (1 << 19), 0, (1 << 20) - 1);
+    glm::vec3 a = glm::abs(n);
+    int axis = a.x > a.y && a.x > a.z ? 0 : (a.y > a.z ? 1 : 2);
+    uint64_t face = 2 * axis + (n[axis] < 0.0f ? 1 : 0);
+    return (((uint64_t)c.x << 43) | ((uint64_t)c.y << 23) | ((uint64_t)c.z << 3) | face) + 1;
+}
+
+size_t Slot(uint64_t key, size_t size) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key & (size - 1);
+}
+
+void Accumulate(std::atomic<float>& sum, float v) {
+    float current = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(current, current + v, std::memory_order_relaxed));
+}
+
+CacheTable Caching::generateTable(size_t size, float cell) {
+    CacheTable table{};
+    table.size = 1;
+    while (table.size < size) table.size <<= 1;
+    table.cell = cell;
+    table.cells.reset(new CacheCell[table.size]);
+    for (size_t i = 0; i < table.size; i++) {
+        table.cells[i].key.store(0, std::memory_order_relaxed);
+        for (int j = 0; j < NMSAMPLES; j++) {
+            table.cells[i].radiance[j].store(0.0f, std::memory_order_relaxed);
+            table.cells[i].samples[j].store(0, std::memory_order_relaxed);
+        }
+    }
+    return table;
+}
+
+void Caching::record(CacheTable& table, const std::vector<CacheRecord>& records) {
+    // a cell is claimed with a compare and swap on its key, a thread that loses the race to the
+    // same key adds to the cell the winner claimed. records that find no free slot are dropped
+    for (const CacheRecord& r : records) {
+        uint64_t key = Key(r.p, r.n, table.cell);
+        size_t slot = Slot(key, table.size);
+        for (int i = 0; i < CACHE_PROBES; i++) {
+            CacheCell& cell = table.cells[(slot + i) & (table.size - 1)];
+            uint64_t current = cell.key.load(std::memory_order_relaxed);
+            if (current == 0 && cell.key.compare_exchange_strong(current, key, std::memory_order_relaxed)) current = key;
+            if (current != key) continue;
+            for (int j = 0; j < NMSAMPLES; j++) {
+                if (!(r.bins & (1u << j))) continue;
+                Accumulate(cell.radiance[j], r.radiance[j]);
+                cell.samples[j].fetch_add(1, std::memory_order_relaxed);
+            }
+            break;
+        }
+    }
+}
+
+void Caching::update(RadianceCache& cache, const CacheTable& table) {
+    // runs between passes, once every thread that recorded has been joined
+    cache.keys.resize(table.size);
+    cache.radiance.resize(table.size);
+    cache.samples.resize(table.size);
+    cache.cell = table.cell;
+    for (size_t i = 0; i < table.size; i++) {
+        const CacheCell& cell = table.cells[i];
+        cache.keys[i] = cell.key.load();
+        cache.samples[i] = 0;
+        for (int j = 0; j < NMSAMPLES; j++) {
+            uint32_t samples = cell.samples[j].load();
+            cache.radiance[i][j] = samples > 0 ? cell.radiance[j].load() / samples : 0.0f;
+            cache.samples[i] = std::max(cache.samples[i], samples);
+        }
+    }
+    cache.passes++;
+}
+
+bool Caching::lookup(const RadianceCache& cache, const glm::vec3& p, const glm::vec3& n, Spectrum& radiance) {
+    if (cache.keys.empty()) return false;
+    uint64_t key = Key(p, n, cache.cell);
+    size_t slot = Slot(key, cache.keys.size());
+    for (int i = 0; i < CACHE_PROBES; i++) {
+        size_t index = (slot + i) & (cache.keys.size() - 1);
+        if (cache.keys[index] == 0) return false;
+        if (cache.keys[index] != key) continue;
+        if (cache.samples[index] < CACHE_MIN_SAMPLES) return false;
+        radiance = cache.radiance[index];
+        return true;
+    }
+    return false;
+}
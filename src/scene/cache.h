@@ -0,0 +1,49 @@
+#pragma once
+
+#include "scene/spectrum.h"
+#include <glm/glm.hpp>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// radiance a path gathered from a diffuse vertex on, over the throughput it arrived there with.
+// diffuse surfaces reflect the same way in every direction, so it is what any path reaching the
+// vertex can expect to gather from there. bins the path carried no light in say nothing
+struct CacheRecord {
+    glm::vec3 p;
+    glm::vec3 n;
+    Spectrum radiance;
+    uint32_t bins; // one bit for every bin the path carried light in
+};
+
+// claimed by the first record whose key lands on it. every field is atomic, so threads record
+// into the same table at once without taking a lock
+struct CacheCell {
+    std::atomic<uint64_t> key;
+    std::atomic<float> radiance[NMSAMPLES];
+    std::atomic<uint32_t> samples[NMSAMPLES];
+};
+
+// open addressed hash of grid cells, every pass records on top of the ones before it
+struct CacheTable {
+    std::unique_ptr<CacheCell[]> cells;
+    size_t size = 0; // a power of two
+    float cell = 0.0f;
+};
+
+// what paths read, the mean of every record so far, in the same slots as the table. cells are
+// keyed by position and by the major axis of the normal, so both sides of a thin wall stay apart
+struct RadianceCache {
+    std::vector<uint64_t> keys; // 0 where no record landed
+    std::vector<Spectrum> radiance;
+    std::vector<uint32_t> samples; // of the bin recorded most often
+    float cell = 0.0f;
+    int passes = 0;
+};
+
+namespace Caching {
+    CacheTable generateTable(size_t size, float cell);
+    void record(CacheTable& table, const std::vector<CacheRecord>& records);
+    void update(RadianceCache& cache, const CacheTable& table);
+    bool lookup(const RadianceCache& cache, const glm::vec3& p, const glm::vec3& n, Spectrum& radiance);
+}
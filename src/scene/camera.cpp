@@ -10,7 +10,7 @@ void Camera::update(size_t w, size_t h) {
     glm::vec3 _w = glm::normalize(look) * -1.0f;
     glm::vec3 _v = glm::normalize(up - glm::dot(up, _w)*_w);
     glm::vec3 _u = glm::cross(_v, _w);
-    glm::mat4 view = 
+    view = 
     MAT4(
         _u.x, _u.y, _u.z, 0,
         _v.x, _v.y, _v.z, 0,
@@ -25,6 +25,7 @@ void Camera::update(size_t w, size_t h) {
         0, 0, 0, 1
     );
     iview = glm::inverse(view);
+    area = 4.0f * std::tan(wangle/2.0f) * std::tan(hangle/2.0f);
 }
 
 Ray Camera::generateRay(size_t x, size_t y) const {
@@ -47,3 +48,23 @@ Ray Camera::generateRay(size_t x, size_t y, float offx, float offy) const {
         ))) - position);
     return r;
 }
+
+bool Camera::project(const glm::vec3& p, glm::vec2& raster, float& pdf) const {
+    // where on the film p is seen, the inverse of generateRay. pdf is the solid angle density of
+    // a camera ray leaving in that direction, over the whole film
+    glm::vec3 c = glm::vec3(view * glm::vec4(p, 1.0f));
+    if (c.z >= 0.0f) return false;
+    float fx = (c.x / -c.z / (2.0f*std::tan(wangle/2.0f)) + 0.5f) * width - 0.5f;
+    float fy = height - 0.5f - (c.y / -c.z / (2.0f*std::tan(hangle/2.0f)) + 0.5f) * height;
+    if (!(fx >= 0.0f && fx < width && fy >= 0.0f && fy < height)) return false;
+    raster = glm::vec2(fx, fy);
+    pdf = this->pdf(p - position);
+    return true;
+}
+
+float Camera::pdf(const glm::vec3& d) const {
+    // rays spread evenly over the film, which lies 1 / cos away and is seen at cos
+    float cosTheta = -glm::vec3(view * glm::vec4(d, 0.0f)).z / glm::length(d);
+    if (cosTheta <= 0.0f) return 0.0f;
+    return 1.0f / (area * cosTheta * cosTheta * cosTheta);
+}
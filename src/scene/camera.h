@@ -11,7 +11,11 @@ struct Camera {
     float wangle;
     size_t width;
     size_t height;
+    glm::mat4 view;
+    float area; // of the film, on a plane one unit in front of the camera
     void update(size_t w, size_t h);
     Ray generateRay(size_t x, size_t y) const;
     Ray generateRay(size_t x, size_t y, float offx, float offy) const;
+    bool project(const glm::vec3& p, glm::vec2& raster, float& pdf) const;
+    float pdf(const glm::vec3& d) const;
 };
@@ -1,5 +1,6 @@
 #include "fourier.h"
 #include "scene/spectrum.h"
+#include "util/fastmath.h"
 #include <cmath>
 
 Fourier::Fourier(const std::vector<float>& samples, float start, float end) : m_start(start), m_end(end) {
@@ -36,6 +37,20 @@ float Fourier::evaluate(float t) const {
     float x = t - m_start;
     float sum = m_a0;
     int N = m_a.size();
+    if (FastMath::enabled) {
+        // one sine and cosine, every higher harmonic from the angle sum identities
+        float s1, c1;
+        FastMath::sincos(omega * x, s1, c1);
+        float s = s1;
+        float c = c1;
+        for (int k = 0; k < N; k++) {
+            sum += m_a[k] * c + m_b[k] * s;
+            float next = c * c1 - s * s1;
+            s = s * c1 + c * s1;
+            c = next;
+        }
+        return sum;
+    }
     for (int k = 1; k <= N; k++)
         sum += m_a[k - 1] * std::cos(k * omega * x) + m_b[k - 1] * std::sin(k * omega * x);
     return sum;
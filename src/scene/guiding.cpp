@@ -0,0 +1,202 @@
+#include "guiding.h"
+#include <algorithm>
+#include <cmath>
+
+#define GUIDE_SPATIAL_SPLIT 512.0f  // lit records a spatial leaf needs before it is halved
+#define GUIDE_SPATIAL_DEPTH 24
+#define GUIDE_ENERGY 0.01f          // share of a tree's energy a quadrant needs to be subdivided
+#define GUIDE_DEPTH 20
+#define GUIDE_RECORDS 64            // lit records a tree needs before it is trusted for sampling
+
+glm::vec2 ToCanonical(const glm::vec3& d) {
+    float phi = std::atan2(d.y, d.x);
+    if (phi < 0.0f) phi += 2.0f * M_PI;
+    return glm::vec2(glm::clamp((d.z + 1.0f) / 2.0f, 0.0f, 0.99999994f), std::min(phi / (2.0f * (float)M_PI), 0.99999994f));
+}
+
+glm::vec3 FromCanonical(glm::vec2 c) {
+    float z = 2.0f * c.x - 1.0f;
+    float r = std::sqrt(std::max(0.0f, 1.0f - z*z));
+    float phi = 2.0f * M_PI * c.y;
+    return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+int Quadrant(glm::vec2& c) {
+    // picks the quadrant c falls in and rescales c to it
+    int qx = c.x >= 0.5f;
+    int qy = c.y >= 0.5f;
+    c = glm::vec2(c.x * 2.0f - qx, c.y * 2.0f - qy);
+    return qx + 2*qy;
+}
+
+void Weights(const DirectionNode& node, float w[4]) {
+    // a node nothing was recorded in is sampled uniformly
+    float total = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+    for (int q = 0; q < 4; q++) w[q] = total > 0.0f ? node.sum[q] : 1.0f;
+}
+
+int Leaf(const Guide& guide, const glm::vec3& p, const glm::vec3& n) {
+    glm::vec3 a = glm::abs(n);
+    int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+    glm::vec3 lo = guide.min;
+    glm::vec3 hi = guide.max;
+    int node = axis*2 + (n[axis] < 0.0f);
+    while (guide.spatial[node].axis >= 0) {
+        const SpatialNode& s = guide.spatial[node];
+        float mid = (lo[s.axis] + hi[s.axis]) / 2.0f;
+        if (p[s.axis] < mid) {
+            hi[s.axis] = mid;
+            node = s.child[0];
+        } else {
+            lo[s.axis] = mid;
+            node = s.child[1];
+        }
+    }
+    return node;
+}
+
+void Split(Guide& guide, int node, glm::vec3 lo, glm::vec3 hi, int depth) {
+    if (guide.spatial[node].axis < 0) {
+        if (guide.spatial[node].samples < GUIDE_SPATIAL_SPLIT || depth >= GUIDE_SPATIAL_DEPTH) return;
+
+        // the bounds are a cube and the axes take turns, so surfaces facing each other across a
+        // thin gap are told apart early. both halves start from what the whole leaf learned
+        int axis = depth % 3;
+        int tree = guide.spatial[node].tree;
+        SpatialNode leaf = { -1, { 0, 0 }, tree, guide.spatial[node].samples / 2.0f };
+        int first = guide.spatial.size();
+        guide.spatial.push_back(leaf);
+        leaf.tree = guide.building.size();
+        guide.spatial.push_back(leaf);
+        guide.building.push_back(guide.building[tree]);
+        guide.sampling.push_back(guide.sampling[tree]);
+        guide.spatial[node].axis = axis;
+        guide.spatial[node].child[0] = first;
+        guide.spatial[node].child[1] = first + 1;
+    }
+    const SpatialNode s = guide.spatial[node];
+    float mid = (lo[s.axis] + hi[s.axis]) / 2.0f;
+    glm::vec3 left = hi;
+    glm::vec3 right = lo;
+    left[s.axis] = mid;
+    right[s.axis] = mid;
+    Split(guide, s.child[0], lo, left, depth + 1);
+    Split(guide, s.child[1], right, hi, depth + 1);
+}
+
+void Rebuild(const DirectionTree& src, int from, const float sum[4], float total, int depth, DirectionTree& dst, int at) {
+    // quadrants holding enough of the energy get children, where the old tree had none the
+    // energy is spread evenly so one pass can refine several levels
+    for (int q = 0; q < 4; q++) {
+        dst.nodes[at].sum[q] = 0.0f;
+        dst.nodes[at].child[q] = 0;
+        if (depth >= GUIDE_DEPTH || total <= 0.0f || sum[q] / total <= GUIDE_ENERGY) continue;
+        int next = from >= 0 ? src.nodes[from].child[q] : 0;
+        float childSum[4];
+        for (int k = 0; k < 4; k++) childSum[k] = next > 0 ? src.nodes[next].sum[k] : sum[q] / 4.0f;
+        int index = dst.nodes.size();
+        dst.nodes.push_back(DirectionNode{});
+        dst.nodes[at].child[q] = index;
+        Rebuild(src, next > 0 ? next : -1, childSum, total, depth + 1, dst, index);
+    }
+}
+
+Guide Guiding::create(const glm::vec3& min, const glm::vec3& max) {
+    Guide guide{};
+    glm::vec3 center = (min + max) / 2.0f;
+    float half = glm::length(max - min) * 0.5f * 1.001f + 0.0001f;
+    guide.min = center - glm::vec3(half);
+    guide.max = center + glm::vec3(half);
+    DirectionTree tree;
+    tree.nodes.push_back(DirectionNode{});
+    for (int i = 0; i < 6; i++) {
+        guide.spatial.push_back({ -1, { 0, 0 }, i, 0.0f });
+        guide.sampling.push_back(tree);
+        guide.building.push_back(tree);
+    }
+    return guide;
+}
+
+const DirectionTree* Guiding::lookup(const Guide& guide, const glm::vec3& p, const glm::vec3& n) {
+    // nothing until a pass has been learned, and nothing where that pass saw too little light to
+    // go by. a tree learned from a handful of paths is confidently wrong, and every bounce that
+    // finds light it missed doubles the path's weight
+    if (guide.passes == 0) return nullptr;
+    const DirectionTree& tree = guide.sampling[guide.spatial[Leaf(guide, p, n)].tree];
+    return tree.records >= GUIDE_RECORDS ? &tree : nullptr;
+}
+
+glm::vec3 Guiding::sample(const DirectionTree& tree, glm::vec2 u) {
+    // each level picks a column and then a row, reusing what is left of u, so strata survive
+    glm::vec2 origin = glm::vec2(0.0f);
+    float size = 1.0f;
+    int node = 0;
+    while (true) {
+        float w[4];
+        Weights(tree.nodes[node], w);
+        float px = (w[0] + w[2]) / (w[0] + w[1] + w[2] + w[3]);
+        int qx = u.x >= px;
+        u.x = qx ? (u.x - px) / (1.0f - px) : u.x / px;
+        float py = w[qx] / (w[qx] + w[qx + 2]);
+        int qy = u.y >= py;
+        u.y = qy ? (u.y - py) / (1.0f - py) : u.y / py;
+        u = glm::clamp(u, glm::vec2(0.0f), glm::vec2(0.99999994f));
+        int q = qx + 2*qy;
+        size /= 2.0f;
+        origin += size * glm::vec2(qx, qy);
+        if (tree.nodes[node].child[q] == 0) return FromCanonical(origin + u * size);
+        node = tree.nodes[node].child[q];
+    }
+}
+
+float Guiding::pdf(const DirectionTree& tree, const glm::vec3& d) {
+    // solid angle density, the map spreads the unit square over 4 pi steradians
+    glm::vec2 c = ToCanonical(d);
+    float density = 1.0f;
+    int node = 0;
+    while (true) {
+        float w[4];
+        Weights(tree.nodes[node], w);
+        int q = Quadrant(c);
+        density *= 4.0f * w[q] / (w[0] + w[1] + w[2] + w[3]);
+        if (tree.nodes[node].child[q] == 0) break;
+        node = tree.nodes[node].child[q];
+    }
+    return density / (4.0f * M_PI);
+}
+
+void Guiding::record(Guide& guide, const std::vector<GuideRecord>& records) {
+    for (const GuideRecord& r : records) {
+        // regions are only split as finely as the light found in them allows
+        if (!(r.radiance > 0.0f) || !std::isfinite(r.radiance)) continue;
+        SpatialNode& leaf = guide.spatial[Leaf(guide, r.p, r.n)];
+        leaf.samples += 1.0f;
+        DirectionTree& tree = guide.building[leaf.tree];
+        tree.records++;
+        glm::vec2 c = ToCanonical(r.d);
+        int node = 0;
+        while (true) {
+            int q = Quadrant(c);
+            tree.nodes[node].sum[q] += r.radiance;
+            if (tree.nodes[node].child[q] == 0) break;
+            node = tree.nodes[node].child[q];
+        }
+    }
+}
+
+void Guiding::refine(Guide& guide) {
+    for (int i = 0; i < 6; i++) Split(guide, i, guide.min, guide.max, 0);
+    for (SpatialNode& leaf : guide.spatial) {
+        if (leaf.axis >= 0) continue;
+        leaf.samples = 0.0f;
+        DirectionTree& built = guide.building[leaf.tree];
+        const DirectionNode& root = built.nodes[0];
+        float total = root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+        DirectionTree next;
+        next.nodes.push_back(DirectionNode{});
+        Rebuild(built, 0, root.sum, total, 1, next, 0);
+        guide.sampling[leaf.tree] = built;
+        built = next;
+    }
+    guide.passes++;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// quadtree over the cylindrical map (cos theta, phi) of the sphere. the map keeps area, so a
+// quadrant's share of the energy is directly its share of the directions sampled
+struct DirectionNode {
+    float sum[4];
+    int child[4]; // 0 when the quadrant is a leaf
+};
+
+struct DirectionTree {
+    std::vector<DirectionNode> nodes;
+    int records = 0; // records that carried any light
+};
+
+// kd split of the scene bounds at midpoints, every leaf owns a directional tree. surfaces facing
+// different ways see light from different hemispheres, so each of the six major normal directions
+// gets a tree of its own
+struct SpatialNode {
+    int axis; // -1 for a leaf
+    int child[2];
+    int tree;
+    float samples; // lit records gathered by the leaf this pass
+};
+
+// incident radiance seen along a path, over the pdf the direction was picked with
+struct GuideRecord {
+    glm::vec3 p;
+    glm::vec3 n;
+    glm::vec3 d;
+    float radiance;
+};
+
+// the sampling trees are what the last pass learned, the building trees gather the current pass
+struct Guide {
+    glm::vec3 min;
+    glm::vec3 max;
+    std::vector<SpatialNode> spatial; // the first six are the roots
+    std::vector<DirectionTree> sampling;
+    std::vector<DirectionTree> building;
+    int passes = 0;
+};
+
+namespace Guiding {
+    Guide create(const glm::vec3& min, const glm::vec3& max);
+    const DirectionTree* lookup(const Guide& guide, const glm::vec3& p, const glm::vec3& n);
+    glm::vec3 sample(const DirectionTree& tree, glm::vec2 u);
+    float pdf(const DirectionTree& tree, const glm::vec3& d);
+    void record(Guide& guide, const std::vector<GuideRecord>& records);
+    void refine(Guide& guide);
+}
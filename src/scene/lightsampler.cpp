@@ -0,0 +1,149 @@
+#include "lightsampler.h"
+#include "scene/scene.h"
+#include "util/fastmath.h"
+#include <algorithm>
+#include <cmath>
+
+void CoordinateSystem(const glm::vec3& a, glm::vec3& b, glm::vec3& c) {
+    // branchless orthonormal basis, after Duff et al.
+    float sign = std::copysign(1.0f, a.z);
+    float k = -1.0f / (sign + a.z);
+    float x = a.x * a.y * k;
+    b = glm::vec3(1.0f + sign * a.x * a.x * k, sign * x, -sign * a.x);
+    c = glm::vec3(x, sign + a.y * a.y * k, -a.y);
+}
+
+bool SampleSphere(const Light& light, const glm::vec3& p, glm::vec2 u, LightSample& ls) {
+    // uniform over the cone of directions the sphere subtends, then back onto the sphere
+    glm::vec3 d = light.position - p;
+    float dc2 = glm::dot(d, d);
+    float r2 = light.radius * light.radius;
+    if (dc2 <= r2) return false;
+    float dc = std::sqrt(dc2);
+    glm::vec3 wc = d / dc;
+    glm::vec3 wx, wy;
+    CoordinateSystem(wc, wx, wy);
+
+    // small caps lose all precision in 1 - cos, so work with sin^2 there instead
+    float sin2Max = r2 / dc2;
+    float cosMax = std::sqrt(std::max(0.0f, 1.0f - sin2Max));
+    float oneMinusCosMax = 1.0f - cosMax;
+    float cosTheta = (cosMax - 1.0f) * u.x + 1.0f;
+    float sin2Theta = 1.0f - cosTheta * cosTheta;
+    if (sin2Max < 0.00068523f) {
+        sin2Theta = sin2Max * u.x;
+        cosTheta = std::sqrt(1.0f - sin2Theta);
+        oneMinusCosMax = sin2Max / 2.0f;
+    }
+
+    // angle at the sphere's center between p and the sampled point
+    float cosAlpha = sin2Theta / std::sqrt(sin2Max) + cosTheta * std::sqrt(std::max(0.0f, 1.0f - sin2Theta / sin2Max));
+    float sinAlpha = std::sqrt(std::max(0.0f, 1.0f - cosAlpha * cosAlpha));
+    float phi = 2.0f * M_PI * u.y;
+    ls.n = -(sinAlpha * std::cos(phi) * wx + sinAlpha * std::sin(phi) * wy + cosAlpha * wc);
+    ls.p = light.position + light.radius * ls.n;
+    ls.pdf = 1.0f / (2.0f * M_PI * oneMinusCosMax);
+    return true;
+}
+
+bool SampleRectangle(const Light& light, const LightGeometry& geometry, const glm::vec3& p, glm::vec2 u, LightSample& ls) {
+    // spherical rectangle sampling, after Urena et al., in a frame where the rectangle is at z0 < 0
+    glm::vec3 d = light.position - p;
+    float x0 = glm::dot(d, geometry.ex);
+    float y0 = glm::dot(d, geometry.ey);
+    float z0 = glm::dot(d, geometry.normal);
+    if (z0 >= 0.0f) return false; // behind the emitting side
+    float x1 = x0 + geometry.width;
+    float y1 = y0 + geometry.height;
+
+    glm::vec3 v00 = glm::vec3(x0, y0, z0);
+    glm::vec3 v01 = glm::vec3(x0, y1, z0);
+    glm::vec3 v10 = glm::vec3(x1, y0, z0);
+    glm::vec3 v11 = glm::vec3(x1, y1, z0);
+    glm::vec3 n0 = glm::normalize(glm::cross(v00, v10));
+    glm::vec3 n1 = glm::normalize(glm::cross(v10, v11));
+    glm::vec3 n2 = glm::normalize(glm::cross(v11, v01));
+    glm::vec3 n3 = glm::normalize(glm::cross(v01, v00));
+    float g0 = std::acos(glm::clamp(-glm::dot(n0, n1), -1.0f, 1.0f));
+    float g1 = std::acos(glm::clamp(-glm::dot(n1, n2), -1.0f, 1.0f));
+    float g2 = std::acos(glm::clamp(-glm::dot(n2, n3), -1.0f, 1.0f));
+    float g3 = std::acos(glm::clamp(-glm::dot(n3, n0), -1.0f, 1.0f));
+    float k = 2.0f * M_PI - g2 - g3;
+    float solidAngle = g0 + g1 - k;
+    if (!(solidAngle > 1e-6f)) return false;
+
+    float au = u.x * solidAngle + k;
+    float fu = (std::cos(au) * n0.z - n2.z) / std::sin(au);
+    float cu = glm::clamp(std::copysign(1.0f, fu) / std::sqrt(fu * fu + n0.z * n0.z), -1.0f, 1.0f);
+    float xu = glm::clamp(-(cu * z0) / std::sqrt(std::max(1e-12f, 1.0f - cu * cu)), x0, x1);
+    float dist = std::sqrt(xu * xu + z0 * z0);
+    float h0 = y0 / std::sqrt(dist * dist + y0 * y0);
+    float h1 = y1 / std::sqrt(dist * dist + y1 * y1);
+    float hv = h0 + u.y * (h1 - h0);
+    float yv = hv * hv < 0.9999f ? hv * dist / std::sqrt(1.0f - hv * hv) : y1;
+
+    ls.p = p + xu * geometry.ex + yv * geometry.ey + z0 * geometry.normal;
+    ls.n = geometry.normal;
+    ls.pdf = 1.0f / solidAngle;
+    return true;
+}
+
+std::vector<LightGeometry> LightSampler::create(const std::vector<Light>& lights) {
+    std::vector<LightGeometry> geometry(lights.size());
+    for (int i = 0; i < lights.size(); i++) {
+        const Light& light = lights[i];
+        LightGeometry& g = geometry[i];
+        g.rectangle = false;
+        Spectrum color = Spectrum(light.color);
+        g.emission = 0.0f;
+        for (int j = 0; j < NMSAMPLES; j++) g.emission += std::max(0.0f, color[j]) / NMSAMPLES;
+        if (light.radius > 0.0f) {
+            g.area = 4.0f * M_PI * light.radius * light.radius;
+        } else if (glm::length(light.hvec) != 0.0f) {
+            glm::vec3 c = glm::cross(light.wvec, light.hvec);
+            g.area = glm::length(c);
+            g.normal = c / g.area;
+            g.width = glm::length(light.wvec);
+            g.height = glm::length(light.hvec);
+            g.ex = light.wvec / g.width;
+            g.ey = light.hvec / g.height;
+            g.rectangle = std::abs(glm::dot(g.ex, g.ey)) < 1e-4f;
+        }
+    }
+    return geometry;
+}
+
+bool LightSampler::sample(const Light& light, const LightGeometry& geometry, const glm::vec3& p, glm::vec2 u, LightSample& ls) {
+    // solid angle pdf at p, false when the light cannot be seen from p at all
+    if (light.radius > 0.0f) return SampleSphere(light, p, u, ls);
+    if (geometry.rectangle) return SampleRectangle(light, geometry, p, u, ls);
+
+    // skewed parallelograms fall back to area sampling
+    ls = sampleArea(light, geometry, u);
+    glm::vec3 d = ls.p - p;
+    float dist2 = glm::dot(d, d);
+    float cosLight = -glm::dot(d, ls.n) / std::sqrt(dist2);
+    if (cosLight <= 0.0f) return false;
+    ls.pdf *= dist2 / cosLight;
+    return true;
+}
+
+LightSample LightSampler::sampleArea(const Light& light, const LightGeometry& geometry, glm::vec2 u) {
+    // uniform over the whole surface, pdf per unit area
+    LightSample ls;
+    ls.pdf = 1.0f / geometry.area;
+    if (light.radius > 0.0f) {
+        float z = 1.0f - 2.0f * u.x;
+        float r = std::sqrt(std::max(0.0f, 1.0f - z*z));
+        float phi = 2.0f * M_PI * u.y;
+        float s, c;
+        if (FastMath::enabled) FastMath::sincos(phi, s, c);
+        else { s = std::sin(phi); c = std::cos(phi); }
+        ls.n = glm::vec3(r * c, r * s, z);
+        ls.p = light.position + light.radius * ls.n;
+    } else {
+        ls.n = geometry.normal;
+        ls.p = light.position + u.x * light.wvec + u.y * light.hvec;
+    }
+    return ls;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Light;
+
+// everything about a light's shape that sampling needs, computed once per render
+struct LightGeometry {
+    glm::vec3 normal;
+    glm::vec3 ex;
+    glm::vec3 ey;
+    float width;
+    float height;
+    float area;
+    float emission; // mean emitted radiance over the spectrum
+    bool rectangle; // area light with perpendicular edges, sampled by solid angle
+};
+
+struct LightSample {
+    glm::vec3 p;
+    glm::vec3 n;
+    float pdf;
+};
+
+namespace LightSampler {
+    std::vector<LightGeometry> create(const std::vector<Light>& lights);
+    bool sample(const Light& light, const LightGeometry& geometry, const glm::vec3& p, glm::vec2 u, LightSample& ls);
+    LightSample sampleArea(const Light& light, const LightGeometry& geometry, glm::vec2 u);
+}
@@ -0,0 +1,155 @@
+#include "lighttree.h"
+#include "scene/scene.h"
+#include "util/log.h"
+#include <algorithm>
+#include <cmath>
+
+struct Cone {
+    glm::vec3 axis;
+    float theta;
+};
+
+Cone MergeCones(const Cone& a, const Cone& b) {
+    // smallest cone around both, after Kulla and Conty Estevez
+    if (a.theta < 0.0f) return b;
+    if (b.theta < 0.0f) return a;
+    float d = std::acos(glm::clamp(glm::dot(a.axis, b.axis), -1.0f, 1.0f));
+    if (std::min(d + b.theta, (float)M_PI) <= a.theta) return a;
+    if (std::min(d + a.theta, (float)M_PI) <= b.theta) return b;
+    float theta = (a.theta + d + b.theta) / 2.0f;
+    if (theta >= M_PI) return { a.axis, (float)M_PI };
+    glm::vec3 k = glm::cross(a.axis, b.axis);
+    if (glm::length(k) < 1e-6f) return { a.axis, (float)M_PI };
+    k = glm::normalize(k);
+
+    // rotate a's axis towards b's so the new cone just touches a's far edge
+    float r = theta - a.theta;
+    glm::vec3 axis = a.axis * std::cos(r) + glm::cross(k, a.axis) * std::sin(r) + k * glm::dot(k, a.axis) * (1.0f - std::cos(r));
+    return { glm::normalize(axis), theta };
+}
+
+int BuildLightTree(std::vector<LightNode>& tree, std::vector<LightNode>& leaves, std::vector<int>& order, int start, int end) {
+    int index = tree.size();
+    if (end - start == 1) {
+        tree.push_back(leaves[order[start]]);
+        return index;
+    }
+
+    // split at the median centroid along the widest axis
+    glm::vec3 cmin = glm::vec3(INFINITY);
+    glm::vec3 cmax = glm::vec3(-INFINITY);
+    for (int i = start; i < end; i++) {
+        glm::vec3 c = (leaves[order[i]].min + leaves[order[i]].max) / 2.0f;
+        cmin = glm::min(cmin, c);
+        cmax = glm::max(cmax, c);
+    }
+    glm::vec3 extent = cmax - cmin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int mid = (start + end) / 2;
+    std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](int a, int b) {
+        return leaves[a].min[axis] + leaves[a].max[axis] < leaves[b].min[axis] + leaves[b].max[axis];
+    });
+
+    tree.push_back(LightNode{});
+    int left = BuildLightTree(tree, leaves, order, start, mid);
+    int right = BuildLightTree(tree, leaves, order, mid, end);
+    const LightNode& l = tree[left];
+    const LightNode& r = tree[right];
+    Cone cone = MergeCones({ l.axis, l.thetaO }, { r.axis, r.thetaO });
+    LightNode node = { glm::min(l.min, r.min), glm::max(l.max, r.max), cone.axis, cone.theta, l.power + r.power, left, right, -1 };
+    tree[index] = node;
+    return index;
+}
+
+bool LightTree::emitter(const Light& light) {
+    return light.radius > 0.0f || glm::length(light.hvec) != 0.0f;
+}
+
+std::vector<LightNode> LightTree::create(const std::vector<Light>& lights) {
+    std::vector<LightNode> tree;
+    std::vector<LightNode> leaves;
+    std::vector<int> order;
+    for (int i = 0; i < lights.size(); i++) {
+        const Light& light = lights[i];
+        if (!emitter(light)) continue;
+        Spectrum color = Spectrum(light.color);
+        float mean = 0.0f;
+        for (int j = 0; j < NMSAMPLES; j++) mean += std::max(0.0f, color[j]) / NMSAMPLES;
+        LightNode leaf{};
+        leaf.left = -1;
+        leaf.right = -1;
+        leaf.light = i;
+        if (light.radius > 0.0f) {
+            leaf.min = light.position - glm::vec3(light.radius);
+            leaf.max = light.position + glm::vec3(light.radius);
+            leaf.axis = glm::vec3(0.0f, 0.0f, 1.0f);
+            leaf.thetaO = M_PI;
+            leaf.power = mean * 4.0f * M_PI * light.radius * light.radius * M_PI;
+        } else {
+            glm::vec3 corner = light.position + light.wvec + light.hvec;
+            leaf.min = glm::min(glm::min(light.position, corner), glm::min(light.position + light.wvec, light.position + light.hvec));
+            leaf.max = glm::max(glm::max(light.position, corner), glm::max(light.position + light.wvec, light.position + light.hvec));
+            leaf.axis = glm::normalize(glm::cross(light.wvec, light.hvec));
+            leaf.thetaO = 0.0f;
+            leaf.power = mean * glm::length(glm::cross(light.wvec, light.hvec)) * M_PI;
+        }
+        if (leaf.power <= 0.0f) continue;
+        order.push_back(leaves.size());
+        leaves.push_back(leaf);
+    }
+    if (leaves.size() == 0) return tree;
+    tree.reserve(2 * leaves.size() - 1);
+    BuildLightTree(tree, leaves, order, 0, leaves.size());
+    return tree;
+}
+
+float Importance(const LightNode& node, const glm::vec3& p, const glm::vec3& n, bool falloff) {
+    // conservative bound on what the node can deliver to p, the angles are widened by the
+    // angle the node's bounding sphere subtends so the bound holds for every light inside
+    glm::vec3 center = (node.min + node.max) / 2.0f;
+    float radius = glm::length(node.max - center);
+    glm::vec3 d = center - p;
+    float dist2 = glm::dot(d, d);
+    if (dist2 <= radius * radius) return node.power;
+    glm::vec3 wi = d / std::sqrt(dist2);
+    float thetaU = std::asin(glm::clamp(radius / std::sqrt(dist2), 0.0f, 1.0f));
+
+    float cosI = 1.0f;
+    if (glm::length(n) > 0.0f) {
+        float thetaI = std::acos(glm::clamp(glm::dot(n, wi), -1.0f, 1.0f));
+        cosI = thetaI - thetaU <= 0.0f ? 1.0f : std::cos(thetaI - thetaU);
+        if (cosI <= 0.0f) return 0.0f;
+    }
+    if (!falloff) return node.power * cosI;
+
+    float theta = std::acos(glm::clamp(glm::dot(node.axis, -wi), -1.0f, 1.0f));
+    float thetaP = std::max(0.0f, theta - node.thetaO - thetaU);
+    if (thetaP >= M_PI / 2.0f) return 0.0f;
+    return node.power * cosI * std::cos(thetaP) / std::max(dist2, radius * radius);
+}
+
+int LightTree::sample(const std::vector<LightNode>& tree, const glm::vec3& p, const glm::vec3& n, float u, float& pmf, bool falloff) {
+    // descend picking a child in proportion to its importance, reusing u at every level
+    pmf = 0.0f;
+    if (tree.size() == 0) return -1;
+    float probability = 1.0f;
+    int index = 0;
+    while (tree[index].light < 0) {
+        const LightNode& node = tree[index];
+        float il = Importance(tree[node.left], p, n, falloff);
+        float ir = Importance(tree[node.right], p, n, falloff);
+        if (il + ir <= 0.0f) return -1;
+        float pl = il / (il + ir);
+        if (u < pl) {
+            u = std::min(u / pl, 0.99999994f);
+            probability *= pl;
+            index = node.left;
+        } else {
+            u = std::min((u - pl) / (1.0f - pl), 0.99999994f);
+            probability *= 1.0f - pl;
+            index = node.right;
+        }
+    }
+    pmf = probability;
+    return tree[index].light;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Light;
+
+// a node bounds the position, emission direction and power of every light below it.
+// normals lie within thetaO of axis. every light here emits over the hemisphere around its
+// normal, so the further pi/2 emission can spread is a constant of Importance, not stored
+struct LightNode {
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 axis;
+    float thetaO;
+    float power;
+    int left;
+    int right;
+    int light;
+};
+
+namespace LightTree {
+    std::vector<LightNode> create(const std::vector<Light>& lights);
+    int sample(const std::vector<LightNode>& tree, const glm::vec3& p, const glm::vec3& n, float u, float& pmf, bool falloff = true);
+    bool emitter(const Light& light);
+}
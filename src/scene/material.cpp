@@ -3,6 +3,8 @@
 #include "util/log.h"
 #include "util/noise.h"
 #include "util/optics.h"
+#include "util/sampler.h"
+#include "util/fastmath.h"
 #include "scene/scene.h"
 #include <iostream>
 #include <ostream>
@@ -16,10 +18,10 @@ Material::Material() {
     configureDefault(); 
 }
 
-// Phase function
 float HenyeyGreenstein(float cosTheta, float g) {
     float denom = 1.f + g*g - 2.f * g * cosTheta;
-    return (1.f - g*g) / (4.f * float(M_PI) * pow(denom, 1.5f));
+    float d15 = FastMath::enabled ? denom * std::sqrt(denom) : pow(denom, 1.5f);
+    return (1.f - g*g) / (4.f * float(M_PI) * d15);
 }
 
 glm::vec3 sampleHG(const glm::vec3& wo, float g, float u1, float u2, float* outPdf) {
@@ -48,25 +50,37 @@ glm::vec3 sampleHG(const glm::vec3& wo, float g, float u1, float u2, float* outP
     }
     return wi;
 }
-std::vector<Sample> Material::sample(const Hit& hit, const Medium& medium) const {
+
+// transmittance through the given optical depth
+float BeerLambert(float depth) {
+    return FastMath::enabled ? FastMath::exp(-depth) : std::exp(-depth);
+}
+
+SampleList Material::sample(const Hit& hit, const Medium& medium) const {
+	SampleList samples;
 	if (m_type == LAMBERTIAN) {
 		glm::vec3 wi = glm::normalize(SampleUtils::onb(hit.n, SampleUtils::hemisphereSample()));
 		float pdf = std::max(0.0f, glm::dot(hit.n, wi)) / M_PI;
-		return {(Sample){ wi, pdf, Spectrum(m_absorb) / M_PI, false, medium.wavelength, medium.ior}};
+		samples.push_back((Sample){ wi, pdf, Spectrum(m_absorb) / M_PI, false, medium.wavelength, medium.ior});
+		return samples;
 	} else if (m_type == DIELECTRIC) {
+		// leaving the material refracts into air, as in raytrace mode. without this rays never bent
+		// on the way out, and light traced from the lights would not retrace camera paths
+		const Material* outside = medium.material == this ? MaterialUtils::AirMaterial() : this;
 		float T = 1.0f;
 		float distance = (hit.p - medium.previous).length();
 		if (!m_diffract) {
 			Sample s{};
 			s.delta = true;
 			s.wavelength = medium.wavelength;
-			if (medium.wavelength >= NMSAMPLES) s.wavelength = jlm::random01()*float(NMSAMPLES);
-			if (medium.material == this) T = std::exp(distance * -m_transmission.evaluate(Spectrum::wavelength(s.wavelength)));
-			float ior = m_ior.evaluate(Spectrum::wavelength(s.wavelength));
+			if (medium.wavelength >= NMSAMPLES) s.wavelength = Sampler::get().get1D()*float(NMSAMPLES);
+			if (medium.material == this) T = BeerLambert(distance * m_transmission.evaluate(Spectrum::wavelength(s.wavelength)));
+			float ior = outside->m_ior.evaluate(Spectrum::wavelength(s.wavelength));
 			float R = Optics::DielectricFresnel(hit.d2c, hit.n, medium.ior, ior);
-			if (jlm::random01() > R) { // REFRACT
+			if (Sampler::get().get1D() > R) { // REFRACT
 				s.pdf = 1.0f - R;
 				s.ior = ior;
+				s.transmitted = true;
 				s.color = Spectrum(m_absorb) * s.pdf * T;
 				s.incoming = glm::normalize(glm::refract(hit.d2c, hit.n, medium.ior / ior));
 			} else { // REFLECT
@@ -76,21 +90,22 @@ std::vector<Sample> Material::sample(const Hit& hit, const Medium& medium) const
 				s.color = (medium.material == this ? Spectrum(1.0f) : Spectrum(m_absorb)) * s.pdf * T;
 				s.incoming = -hit.d2r;
 			}
-			return {s};
+			samples.push_back(s);
+			return samples;
 		} else {
-			std::vector<Sample> samples;
 			for (int i = 0; i < NMSAMPLES; i++) {
 				Sample s{};
 				s.delta = true;
 				if (medium.wavelength < NMSAMPLES) i = medium.wavelength;
 				s.wavelength = i;
-				float ior = m_ior.evaluate(Spectrum::wavelength(s.wavelength));
+				float ior = outside->m_ior.evaluate(Spectrum::wavelength(s.wavelength));
 				float R = Optics::DielectricFresnel(hit.d2c, hit.n, medium.ior, ior);
 				Spectrum absorbtion = Spectrum::isolate(Spectrum(m_absorb), s.wavelength);
-				if (medium.material == this) T = std::exp(distance * -m_transmission.evaluate(Spectrum::wavelength(s.wavelength)));
-				if (jlm::random01() > R) { // REFRACT
+				if (medium.material == this) T = BeerLambert(distance * m_transmission.evaluate(Spectrum::wavelength(s.wavelength)));
+				if (Sampler::get().get1D() > R) { // REFRACT
 					s.pdf = 1.0f - R;
 					s.ior = ior;
+					s.transmitted = true;
 					s.incoming = glm::normalize(glm::refract(hit.d2c, hit.n, medium.ior / ior));
 				} else { // REFLECT
 					if (medium.material == this) absorbtion = Spectrum(1.0f);
@@ -105,27 +120,27 @@ std::vector<Sample> Material::sample(const Hit& hit, const Medium& medium) const
 			return samples;
 		}
     } else if (m_type == VOLUMETRIC) {
+            // the boundary of a medium that was not baked into a density grid, which only the path
+            // kernel tracks. the path goes straight through, weighted by a ray march since the last vertex
             glm::vec3 dir = (hit.p - medium.previous);
             float distance = glm::length(dir);
             glm::vec3 rayDir = glm::normalize(dir);
 
-            const float densityScale = 1.25f;
+            // the march's points go through the noise in one batch. density is floored at zero like
+            // the baked grid's, so the weight never goes negative and transmission stays at most one
             const int STEPS = 16;
+            glm::vec3 points[STEPS];
+            float noise[STEPS];
+            for (int i = 0; i < STEPS; i++) points[i] = medium.previous + rayDir * (distance * (i + 0.5f) / STEPS);
+            Noise::get().applyPerlinWorley(points, noise, STEPS);
             float weight = 0.0f;
+            for (int i = 0; i < STEPS; i++) weight += VOLUME_DENSITY * std::max(0.0f, 2.0f * noise[i] - 1.0f) * (distance / STEPS);
 
-            // basic raymarch (attenuation only)
-            for (int i = 0; i < STEPS; i++) {
-                glm::vec3 pos = medium.previous + rayDir * (distance * (i + 0.5f) / STEPS);
-                float density = Noise::get().applyPerlinWorley(pos);
-                density = (density < 0.22f) ? 0.0f : (density - 0.5f) * 2.0f;
-                weight += density * densityScale * (distance / STEPS);
-            }
-
-            float T = glm::clamp(expf(-weight), 1.f, 2.f);
+            float T = BeerLambert(weight);
             Sample s{};
             s.delta = true;
             s.wavelength = medium.wavelength;
-            if (medium.wavelength >= NMSAMPLES) s.wavelength = jlm::random01() * float(NMSAMPLES);
+            if (medium.wavelength >= NMSAMPLES) s.wavelength = Sampler::get().get1D() * float(NMSAMPLES);
             s.ior = medium.ior;
             s.incoming = rayDir;
             s.pdf = 1.0f;
@@ -134,11 +149,13 @@ std::vector<Sample> Material::sample(const Hit& hit, const Medium& medium) const
             Spectrum fogColor = Spectrum(1.0f);
             s.color = fogColor * (1.0f - T) + Spectrum(T);
 
-            return {s};
+            samples.push_back(s);
+            return samples;
     }
 
 	FATAL("Unhandled material type detected");
-	return {Sample{}};
+	samples.push_back(Sample{});
+	return samples;
 }
 
 void Material::configureDefault() {
@@ -204,6 +221,12 @@ Material* MaterialUtils::FogMaterial() {
     return &g_fog_material;
 }
 
+Material* MaterialUtils::continued(Material* m, const Medium& medium, const Sample& sample) {
+	if (m->type() != DIELECTRIC) return m;
+	if (!sample.transmitted) return medium.material;
+	return medium.material == m ? AirMaterial() : m;
+}
+
 glm::vec3 SampleUtils::onb(const glm::vec3& normal, const glm::vec3& local) {
 	glm::vec3 w = normal;
 	glm::vec3 a = (fabs(w.x) > 0.9f) ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
@@ -213,11 +236,15 @@ glm::vec3 SampleUtils::onb(const glm::vec3& normal, const glm::vec3& local) {
 }
 
 glm::vec3 SampleUtils::hemisphereSample() {
-	float r1 = jlm::random01();
-	float r2 = jlm::random01();
+	glm::vec2 u = Sampler::get().get2D();
+	float r1 = u.x;
+	float r2 = u.y;
 	float phi = 2.0f*M_PI*r1;
-	double x = std::cos(phi)*std::sqrt(1 - r2);
-	double y = std::sin(phi)*std::sqrt(1 - r2);
-	double z = std::sqrt(r2);
+	float s, c;
+	if (FastMath::enabled) FastMath::sincos(phi, s, c);
+	else { s = std::sin(phi); c = std::cos(phi); }
+	float x = c*std::sqrt(1 - r2);
+	float y = s*std::sqrt(1 - r2);
+	float z = std::sqrt(r2);
 	return glm::vec3(x, y, z);
 }
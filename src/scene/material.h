@@ -18,20 +18,34 @@ struct Sample {
 	bool delta;
 	int wavelength;
 	float ior;
+	bool transmitted = false; // passed through the surface rather than reflecting off it
 
     // raymarching
     bool isVolume = false;
-    float transmission;
+    float transmission = 0.0f;
     glm::vec3 eventPos = glm::vec3(0);
 };
 
+// what a material returns from sampling, at most one sample per wavelength, held in place so
+// sampling never allocates
+struct SampleList {
+	Sample samples[NMSAMPLES];
+	int count = 0;
+
+	void push_back(const Sample& s) { samples[count++] = s; }
+	int size() const { return count; }
+	bool empty() const { return count == 0; }
+	Sample& operator[](int i) { return samples[i]; }
+	const Sample& operator[](int i) const { return samples[i]; }
+};
+
 struct Medium;
 
 class Material {
 public:
     Material();
 public:
-	std::vector<Sample> sample(const Hit& hit, const Medium& medium) const;
+	SampleList sample(const Hit& hit, const Medium& medium) const;
 public:
     void configureAir();
     void configureDefault();
@@ -81,9 +95,16 @@ namespace MaterialUtils {
     Material* DefaultMaterial();
     Material* AirMaterial();
     Material* FogMaterial();
+    // the material a path is inside after sampling m. only light passing through a dielectric
+    // changes it, into m from outside and back into air from inside
+    Material* continued(Material* m, const Medium& medium, const Sample& sample);
 };
 
 namespace SampleUtils {
 	glm::vec3 onb(const glm::vec3& normal, const glm::vec3& local);
 	glm::vec3 hemisphereSample();
 };
+
+// phase function for scattering inside a volume, and a direction sampled from it around -wo
+float HenyeyGreenstein(float cosTheta, float g);
+glm::vec3 sampleHG(const glm::vec3& wo, float g, float u1, float u2, float* outPdf);
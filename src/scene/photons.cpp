@@ -0,0 +1,65 @@
+#include "photons.h"
+#include <cmath>
+
+#define PHOTON_ALPHA (2.0f / 3.0f) // share of the photons each pass keeps as the radius shrinks
+
+uint32_t Bucket(const glm::ivec3& c, uint32_t mask) {
+    return ((uint32_t)c.x * 73856093u ^ (uint32_t)c.y * 19349663u ^ (uint32_t)c.z * 83492791u) & mask;
+}
+
+glm::ivec3 Cell(const PhotonMap& map, const glm::vec3& p) {
+    return glm::ivec3(glm::floor(p / map.cell));
+}
+
+PhotonMap PhotonMapping::create(std::vector<Photon> photons, float radius) {
+    // counting sort into the buckets, in photon order so the result never depends on threading
+    PhotonMap map;
+    map.radius = radius;
+    map.cell = 2.0f * radius;
+    uint32_t size = 1;
+    while (size < 2 * photons.size()) size <<= 1;
+    map.buckets.assign(size + 1, 0);
+    std::vector<uint32_t> keys(photons.size());
+    for (size_t i = 0; i < photons.size(); i++) {
+        keys[i] = Bucket(Cell(map, photons[i].p), size - 1);
+        map.buckets[keys[i] + 1]++;
+    }
+    for (uint32_t i = 0; i < size; i++) map.buckets[i + 1] += map.buckets[i];
+    std::vector<int> cursor(map.buckets.begin(), map.buckets.end() - 1);
+    map.photons.resize(photons.size());
+    for (size_t i = 0; i < photons.size(); i++) map.photons[cursor[keys[i]]++] = photons[i];
+    return map;
+}
+
+int PhotonMapping::lookup(const PhotonMap& map, const glm::vec3& p, int ranges[16]) {
+    // begin and end of every bucket that may hold a photon within the radius of p. cells that
+    // share a bucket are only listed once
+    if (map.photons.empty()) return 0;
+    uint32_t mask = map.buckets.size() - 2;
+    glm::ivec3 lo = Cell(map, p - glm::vec3(map.radius));
+    glm::ivec3 hi = Cell(map, p + glm::vec3(map.radius));
+    uint32_t seen[8];
+    int count = 0;
+    for (int x = lo.x; x <= hi.x; x++) {
+        for (int y = lo.y; y <= hi.y; y++) {
+            for (int z = lo.z; z <= hi.z; z++) {
+                uint32_t b = Bucket(glm::ivec3(x, y, z), mask);
+                bool repeat = false;
+                for (int i = 0; i < count; i++) repeat = repeat || seen[i] == b;
+                if (repeat || map.buckets[b] == map.buckets[b + 1]) continue;
+                ranges[2*count] = map.buckets[b];
+                ranges[2*count + 1] = map.buckets[b + 1];
+                seen[count++] = b;
+            }
+        }
+    }
+    return count;
+}
+
+float PhotonMapping::radius(float initial, int pass) {
+    // progressive photon mapping: every pass shrinks the area so that only a share alpha of the
+    // photons it would have gathered remain, which drives the bias to zero as passes grow
+    float r2 = initial * initial;
+    for (int i = 1; i <= pass; i++) r2 *= (i + PHOTON_ALPHA) / (i + 1.0f);
+    return std::sqrt(r2);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "scene/spectrum.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// a photon that reached a diffuse surface through at least one specular event. photons carry a
+// single wavelength bin, so dispersion bends each one along its own path
+struct Photon {
+    glm::vec3 p;
+    glm::vec3 d;
+    float power;
+    int wavelength;
+    int source; // light index, or -1 - material for emissive primitives
+};
+
+// somewhere photons leave from, picked in proportion to its flux
+struct PhotonSource {
+    int light;     // -1 for an emissive primitive
+    int primitive;
+    Spectrum emission;
+    float flux;    // mean over the spectrum
+};
+
+// one pass's photons, hashed into a grid of cells twice the gather radius wide so a lookup
+// never has to visit more than the eight cells around it
+struct PhotonMap {
+    std::vector<Photon> photons; // grouped by bucket
+    std::vector<int> buckets;    // where each bucket starts in photons, with one past the end last
+    float radius = 0.0f;
+    float cell = 0.0f;
+};
+
+namespace PhotonMapping {
+    PhotonMap create(std::vector<Photon> photons, float radius);
+    int lookup(const PhotonMap& map, const glm::vec3& p, int ranges[16]);
+    float radius(float initial, int pass);
+}
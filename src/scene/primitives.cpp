@@ -1,51 +1,6 @@
 #include "primitives.h"
 #include "util/log.h"
 
-Hit sphereIntersect(const Ray& ray, const Primitive& prim) {
-    Hit h;
-    h.t = -1.0f;
-    glm::vec3 l = ray.p - prim.v1;
-    float r2 = prim.v2.x*prim.v2.x;
-    float hb = glm::dot(ray.d, l);
-    float c = glm::dot(l, l) - r2;
-    float dis = hb*hb - c;
-    if (dis < 0.0f) return h;
-    float sq = std::sqrt(dis);
-    float t1 = -hb - sq;
-    float t2 = -hb + sq;
-    if (t1 < 0) t1 = t2;
-    if (t2 < 0) t2 = t1;
-    h.t = t1 < t2 ? t1 : t2;
-    h.p = ray.p + ray.d * h.t;
-    h.n = glm::normalize(h.p - prim.v1);
-	h.material = prim.material;
-    return h;
-}
-
-Hit triangleIntersect(const Ray& ray, const Primitive& prim) {
-    Hit h;
-    h.t = -1.0f;
-    const float EPS = 1e-8;
-    glm::vec3 ab = prim.v2 - prim.v1;
-    glm::vec3 ac = prim.v3 - prim.v1;
-    glm::vec3 pvec = glm::cross(ray.d, ac);
-    float det = glm::dot(ab, pvec);
-    if (fabs(det) < EPS) return h;
-    float idet = 1.0f / det;
-    glm::vec3 tvec = ray.p - prim.v1;
-    float u = glm::dot(tvec, pvec) * idet;
-    if (u < 0.0f || u > 1.0f) return h;
-    glm::vec3 qvec = glm::cross(tvec, ab);
-    float v = glm::dot(ray.d, qvec) * idet;
-    if (v < 0.0f || u + v > 1.0f) return h;
-    h.t = glm::dot(ac, qvec) * idet;
-    h.p = ray.p + (ray.d*h.t);
-    h.n = glm::normalize(glm::cross(ab, ac));
-    // if (glm::dot(glm::normalize(ab), glm::normalize(ac)) < 0.0f) h.n *= -1.0f; this is wrong. but makes some incredible outputs
-	h.material = prim.material;
-    return h;
-}
-
 Primitive PrimitiveUtils::sphere(glm::vec3 position, float radius, int material) {
     return (Primitive) {
         SPHERE,
@@ -93,17 +48,16 @@ AABB PrimitiveUtils::generateAABB(Primitive p) {
 }
 
 Hit PrimitiveUtils::intersect(const Ray& ray, const Primitive& p) {
-    switch (p.type) {
-        case SPHERE:
-            return sphereIntersect(ray, p); 
-            break;
-        case TRIANGLE:
-            return triangleIntersect(ray, p);
-        default:
-            FATAL("Unhandled primitive type detected");
-            break;
+    return intersect<MIXED_PRIMITIVES>(ray, p);
+}
+
+PrimitiveMix PrimitiveUtils::mix(const std::vector<Primitive>& primitives) {
+    bool spheres = false;
+    bool triangles = false;
+    for (const Primitive& p : primitives) {
+        spheres = spheres || p.type == SPHERE;
+        triangles = triangles || p.type == TRIANGLE;
     }
-    Hit h{};
-    h.t = -1.0f;
-    return h;
+    if (spheres && triangles) return MIXED_PRIMITIVES;
+    return spheres ? ONLY_SPHERES : ONLY_TRIANGLES;
 }
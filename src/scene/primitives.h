@@ -3,12 +3,21 @@
 #include "scene/aabb.h"
 #include "scene/ray.h"
 #include "scene/hit.h"
+#include <cmath>
+#include <vector>
 
 enum PrimitiveType {
     SPHERE,
     TRIANGLE
 };
 
+// which kinds of primitive a scene holds, so traversal only tests for the ones it can meet
+enum PrimitiveMix {
+    ONLY_TRIANGLES,
+    ONLY_SPHERES,
+    MIXED_PRIMITIVES
+};
+
 struct Primitive {
     PrimitiveType type;
     glm::vec3 v1;
@@ -24,4 +33,58 @@ namespace PrimitiveUtils {
     float sphereRadius(Primitive sphere);
     AABB generateAABB(Primitive p);
     Hit intersect(const Ray& ray, const Primitive& p);
+    PrimitiveMix mix(const std::vector<Primitive>& primitives);
+
+    // inline, so traversal specialised on a scene's mix tests its leaves without a call or a switch
+    inline Hit sphereIntersect(const Ray& ray, const Primitive& prim) {
+        Hit h;
+        h.t = -1.0f;
+        glm::vec3 l = ray.p - prim.v1;
+        float r2 = prim.v2.x*prim.v2.x;
+        float hb = glm::dot(ray.d, l);
+        float c = glm::dot(l, l) - r2;
+        float dis = hb*hb - c;
+        if (dis < 0.0f) return h;
+        float sq = std::sqrt(dis);
+        float t1 = -hb - sq;
+        float t2 = -hb + sq;
+        if (t1 < 0) t1 = t2;
+        if (t2 < 0) t2 = t1;
+        h.t = t1 < t2 ? t1 : t2;
+        h.p = ray.p + ray.d * h.t;
+        h.n = glm::normalize(h.p - prim.v1);
+        h.material = prim.material;
+        return h;
+    }
+
+    inline Hit triangleIntersect(const Ray& ray, const Primitive& prim) {
+        Hit h;
+        h.t = -1.0f;
+        const float EPS = 1e-8;
+        glm::vec3 ab = prim.v2 - prim.v1;
+        glm::vec3 ac = prim.v3 - prim.v1;
+        glm::vec3 pvec = glm::cross(ray.d, ac);
+        float det = glm::dot(ab, pvec);
+        if (fabs(det) < EPS) return h;
+        float idet = 1.0f / det;
+        glm::vec3 tvec = ray.p - prim.v1;
+        float u = glm::dot(tvec, pvec) * idet;
+        if (u < 0.0f || u > 1.0f) return h;
+        glm::vec3 qvec = glm::cross(tvec, ab);
+        float v = glm::dot(ray.d, qvec) * idet;
+        if (v < 0.0f || u + v > 1.0f) return h;
+        h.t = glm::dot(ac, qvec) * idet;
+        h.p = ray.p + (ray.d*h.t);
+        h.n = glm::normalize(glm::cross(ab, ac));
+        // if (glm::dot(glm::normalize(ab), glm::normalize(ac)) < 0.0f) h.n *= -1.0f; this is wrong. but makes some incredible outputs
+        h.material = prim.material;
+        return h;
+    }
+
+    template <PrimitiveMix Mix>
+    inline Hit intersect(const Ray& ray, const Primitive& p) {
+        if (Mix == ONLY_TRIANGLES) return triangleIntersect(ray, p);
+        if (Mix == ONLY_SPHERES) return sphereIntersect(ray, p);
+        return p.type == SPHERE ? sphereIntersect(ray, p) : triangleIntersect(ray, p);
+    }
 };
@@ -4,46 +4,152 @@
 #include "scene/material.h"
 #include "util/optics.h"
 #include "util/jlm.h"
-#include "util/halton.h"
+#include "util/sampler.h"
+#include "util/fastmath.h"
 #include "renderer/config.h"
+#include "renderer/splat.h"
+#include "renderer/wavefront.h"
+#include "renderer/restir.h"
 #include <iostream>
+#include <algorithm>
+#include <cfloat>
 
 #define EPSILON 0.0001f
+#define ADAPTIVE_BATCH 4
+#define ADAPTIVE_FLOOR 0.02f
+#define LIGHT_SAMPLES 25
+#define RAYTRACE_LIGHT_SAMPLES 100
+static_assert(LIGHT_SAMPLES <= SHADOW_STREAM, "every light sample's shadow ray fits in one stream");
+#define GUIDE_FRACTION 0.5f
+#define GUIDE_VERTICES 32
+#define GUIDE_TRAINING_INDEX (1u << 20)
+#define CACHE_WARMING_INDEX (1u << 21)
+#define PREVIEW_INDEX (1u << 22)
+#define CACHE_VERTICES 32
+#define PHOTON_STREAM 0xffffffffu // never a pixel column, so photons stay independent of camera samples
+#define BDPT_STREAM 0xfffffffeu   // light subpaths, seeded by pixel so each pixel's stay stratified
+#define RAYTRACE_CUTOFF 0.001f // branches that could add less than this share of their light are culled
 
-Spectrum Scene::shade(int x, int y) {
+// adds a contribution to the path radiance. bins maps each wavelength bin to where it lands after
+// every wavelength conversion between the contribution and the camera
+static inline void deposit(Spectrum& radiance, const Spectrum& c, const int* bins, std::vector<Spectrum>* aov, int channel) {
+    for (int j = 0; j < NMSAMPLES; j++) radiance[bins[j]] += c[j];
+    if (aov) for (int j = 0; j < NMSAMPLES; j++) (*aov)[channel][bins[j]] += c[j];
+}
+
+Spectrum Scene::shade(int x, int y, std::vector<Spectrum>* aov, int* spent, const Reservoir* reservoir, SplatBuffer* splats) {
+    // light tracing splats assume every pixel takes the same number of samples
+    bool adaptive = GlobalConfig::pathtrace() && GlobalConfig::adaptive() && !splats;
     int count = GlobalConfig::pathtrace() ? GlobalConfig::pathSamples() : 1;
+    int limit = count;
+    int minimum = count;
+    if (adaptive) {
+        limit = GlobalConfig::adaptiveMax() > 0 ? GlobalConfig::adaptiveMax() : 4*count;
+        minimum = std::min(limit, std::max(ADAPTIVE_BATCH, count/4));
+    }
     Spectrum s = Spectrum(0.0f);
-    std::vector<glm::vec2> offsets = Halton::generate(GlobalConfig::pathSamples(), x, y);
-    for (int i = 0; i < count; i++) {
-        Ray ray = camera.generateRay(x, y, offsets[i].x, offsets[i].y);
-        s += shade(ray, (Medium){ 1.0f, 0, MaterialUtils::AirMaterial(), Spectrum(1.0f), NMSAMPLES, ray.p}, 0);
-    }
-    return s / float(count);
-}
-
-Spectrum Scene::shade(const Ray& ray, const Medium& medium, int recur) {
-    Hit h = intersect(ray);
-    if (recur == 0) {
-        Hit h1 = intersect2(ray);
-        if (h1.t > 0.0 && (h1.t < h.t || h.t <= 0.0f)) {
-            return (GlobalConfig::pathtrace() ? pathColor(h1, medium, recur) : rayColor(h1, medium, recur));
-        }
-    }
-   
-    if (h.t > 0.0f) return (GlobalConfig::pathtrace() ? pathColor(h, medium, recur) : rayColor(h, medium, recur));
-	else if (GlobalConfig::pathtrace() && medium.material->type() != VOLUMETRIC && medium.material != MaterialUtils::AirMaterial()) {
-		// DIRECT LIGHTING ON MISS
-		Hit h2{};
-		h2.n = ray.d;
-		h2.p = ray.p;
-		Spectrum s = Spectrum(0.0f);
-		for (int i = 0; i < lights.size(); i++) {
-			DirectLightData dld = SceneUtils::directLight(lights[i], h2, *medium.material);
-			s += (dld.color * medium.material->diffuse().evaluate(dld.diffuse) * medium.throughput);
-		}
-		return s;
-	}
-    return Spectrum(0.0f);
+    Sampler& sampler = Sampler::get();
+    float mean = 0.0f;
+    float m2 = 0.0f;
+    int n = 0;
+    while (n < limit) {
+        sampler.start(x, y, n);
+        glm::vec2 offset = sampler.get2D();
+        Ray ray = camera.generateRay(x, y, offset.x, offset.y);
+        const PhotonMap* photons = photonMaps.empty() ? nullptr : &photonMaps[n % photonMaps.size()];
+        Spectrum c = GlobalConfig::pathtrace() ? (splats ? bidirectional(ray, x, y, n, *splats) : pathColor(ray, aov, reservoir, photons))
+            : rayTree(ray, (Medium){ 1.0f, 0, MaterialUtils::AirMaterial(), Spectrum(1.0f), NMSAMPLES, ray.p});
+        s += c;
+        n++;
+        if (!adaptive) continue;
+
+        // ADAPTIVE STOPPING
+        // running luminance variance, a pixel stops once the standard error of its mean is
+        // within the target relative error (dark pixels are measured against a small floor)
+        float lum = c.xyz().y;
+        float delta = lum - mean;
+        mean += delta / float(n);
+        m2 += delta * (lum - mean);
+        if (n >= minimum && n % ADAPTIVE_BATCH == 0) {
+            float stderror = std::sqrt(m2 / float(n - 1) / float(n));
+            if (stderror <= GlobalConfig::adaptiveError() * std::max(mean, ADAPTIVE_FLOOR)) break;
+        }
+    }
+    if (spent) *spent = n;
+    if (aov) for (int i = 0; i < aov->size(); i++) (*aov)[i] = (*aov)[i] / float(n);
+    return s / float(n);
+}
+
+Spectrum Scene::train(int x, int y, int pass, std::vector<GuideRecord>& records) {
+    // training samples sit far past any index the final render uses, so they stay independent of it
+    // pass n takes 2^n samples, so each pass has as much to learn from as all the ones before it.
+    // the sum is returned so the paths can still count towards the image
+    Sampler& sampler = Sampler::get();
+    Spectrum color(0.0f);
+    for (int n = 0; n < (1 << pass); n++) {
+        sampler.start(x, y, GUIDE_TRAINING_INDEX + (1 << pass) - 1 + n);
+        glm::vec2 offset = sampler.get2D();
+        const PhotonMap* photons = photonMaps.empty() ? nullptr : &photonMaps[n % photonMaps.size()];
+        color += pathColor(camera.generateRay(x, y, offset.x, offset.y), nullptr, nullptr, photons, &records);
+    }
+    return color;
+}
+
+Spectrum Scene::preview(int x, int y) {
+    // from sample indices of their own, so the final render can average these in as more samples
+    // of the same pixel. the sum is returned, like training paths
+    Sampler& sampler = Sampler::get();
+    Spectrum color(0.0f);
+    for (int n = 0; n < GlobalConfig::previewSamples(); n++) {
+        sampler.start(x, y, PREVIEW_INDEX + n);
+        glm::vec2 offset = sampler.get2D();
+        color += pathColor(camera.generateRay(x, y, offset.x, offset.y), nullptr, nullptr, nullptr);
+    }
+    return color;
+}
+
+void Scene::warm(int x, int y, int pass, std::vector<CacheRecord>& records) {
+    // one path per pixel and pass, from sample indices neither the render nor the guide reach
+    Sampler& sampler = Sampler::get();
+    sampler.start(x, y, CACHE_WARMING_INDEX + pass);
+    glm::vec2 offset = sampler.get2D();
+    const PhotonMap* photons = photonMaps.empty() ? nullptr : &photonMaps[pass % photonMaps.size()];
+    pathColor(camera.generateRay(x, y, offset.x, offset.y), nullptr, nullptr, photons, nullptr, &records);
+}
+
+Spectrum Scene::shadeRaster(glm::vec2& raster, int pass) {
+    // one path from wherever the first two sampler dimensions put it on the film, for the
+    // metropolis chains, which decide the pixel by mutating those dimensions like any other
+    Sampler& sampler = Sampler::get();
+    glm::vec2 u = sampler.get2D();
+    raster = glm::min(u * glm::vec2(camera.width, camera.height), glm::vec2(camera.width, camera.height) - 0.001f);
+    size_t x = raster.x;
+    size_t y = raster.y;
+    const PhotonMap* photons = photonMaps.empty() ? nullptr : &photonMaps[pass % photonMaps.size()];
+    return pathColor(camera.generateRay(x, y, raster.x - x, raster.y - y), nullptr, nullptr, photons);
+}
+
+Spectrum Scene::rayTree(const Ray& ray, const Medium& medium) {
+    // breadth first over an explicit list, so the branches nearest the camera are the ones traced
+    // once the pixel's budget runs out, and no pixel traces more than the budget however many
+    // dielectrics its rays split at (queueBranch stops adding branches once it is spent).
+    // kept by the thread from pixel to pixel, so it only allocates while it grows
+    static thread_local std::vector<RayBranch> tree;
+    tree.clear();
+    RayBranch root = { ray, medium, 0, Spectrum(1.0f) };
+    for (int j = 0; j < NMSAMPLES; j++) root.bins[j] = j;
+    tree.push_back(root);
+    Spectrum radiance = Spectrum(0.0f);
+    for (size_t next = 0; next < tree.size(); next++) {
+        RayBranch branch = tree[next];
+        Hit h = intersect(branch.ray);
+        if (branch.depth == 0) {
+            Hit h1 = intersect2(branch.ray);
+            if (h1.t > 0.0 && (h1.t < h.t || h.t <= 0.0f)) h = h1;
+        }
+        if (h.t > 0.0f) rayColor(h, branch, tree, radiance);
+    }
+    return radiance;
 }
 
 void Scene::pollMetadata(const Ray& ray, glm::vec3& n, glm::vec3& p, glm::vec3& a) const {
@@ -56,11 +162,260 @@ void Scene::pollMetadata(const Ray& ray, glm::vec3& n, glm::vec3& p, glm::vec3&
 	}
 }
 
+bool Scene::occluded(const glm::vec3& p, const glm::vec3& q) const {
+	glm::vec3 direction = q - p;
+	float dist = glm::length(direction);
+	glm::vec3 dirNorm = direction / dist;
+	float t = intersect({ p + dirNorm * EPSILON, dirNorm }).t;
+	return t >= 0.0f && t < dist;
+}
+
+uint32_t Scene::occluded(const ShadowStream& stream) const {
+	if (bvh.size() == 0 || stream.count == 0) return 0;
+	uint32_t active = stream.count == SHADOW_STREAM ? ~0u : (1u << stream.count) - 1;
+	switch (mix) {
+		case ONLY_TRIANGLES: return traverseShadows<ONLY_TRIANGLES>(stream, active, 0);
+		case ONLY_SPHERES: return traverseShadows<ONLY_SPHERES>(stream, active, 0);
+		default: return traverseShadows<MIXED_PRIMITIVES>(stream, active, 0);
+	}
+}
+
+// adds a shadow ray from the stream's origin, to be traced by occluded()
+static inline void streamShadow(ShadowStream& stream, const glm::vec3& d, float dist) {
+	ASSERT(stream.count < SHADOW_STREAM, "Shadow stream overflow");
+	stream.d[stream.count] = d;
+	stream.dfrac[stream.count] = glm::vec3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+	stream.dist[stream.count] = dist;
+	stream.count++;
+}
+
+void Scene::prepareAOVs() {
+	// one channel per light, followed by one per emissive material
+	aovmap.assign(materials.size(), -1);
+	int channel = lights.size();
+	for (int i = 0; i < materials.size(); i++)
+		if (materials[i].emissive()) aovmap[i] = channel++;
+}
+
+int Scene::aovCount() const {
+	int count = lights.size();
+	for (int i = 0; i < aovmap.size(); i++) if (aovmap[i] >= 0) count++;
+	return count;
+}
+
+std::string Scene::aovName(int channel) const {
+	if (channel < lights.size()) return "light" + std::to_string(channel);
+	for (const auto& entry : matmap)
+		if (entry.second < aovmap.size() && aovmap[entry.second] == channel) return entry.first;
+	return "unknown";
+}
+
+void Scene::prepareEmitters() {
+	// area weighted list of every primitive with an emissive material
+	emitters.clear();
+	emitterCDF.clear();
+	emitterArea = 0.0f;
+	for (int i = 0; i < primitives.size(); i++) {
+		const Primitive& p = primitives[i];
+		if (p.material < 0 || !materials[p.material].emissive()) continue;
+		float area = p.type == SPHERE ? 4.0f * M_PI * p.v2.x * p.v2.x
+			: 0.5f * glm::length(glm::cross(p.v2 - p.v1, p.v3 - p.v1));
+		if (area <= 0.0f) continue;
+		emitterArea += area;
+		emitters.push_back(i);
+		emitterCDF.push_back(emitterArea);
+	}
+	for (int i = 0; i < emitterCDF.size(); i++) emitterCDF[i] /= emitterArea;
+}
+
+void Scene::prepareKernels() {
+	// after prepareEmitters, whatever the scene lacks is left out of the kernel its paths run
+	features = emitters.empty() ? 0 : FEATURE_EMITTERS;
+	// volumes are either baked and tracked, or still primitives the paths march through
+	for (const Material& m : materials) {
+		if (m.type() == VOLUMETRIC) features |= FEATURE_VOLUMES;
+		if (m.type() == DIELECTRIC && m.diffract()) features |= FEATURE_DIFFRACTION;
+	}
+	mix = PrimitiveUtils::mix(primitives);
+	mix2 = PrimitiveUtils::mix(lPrimitive);
+}
+
+void Scene::prepareVolumes() {
+	// before the BVH is built, every volumetric material's primitives are baked into a density grid
+	// and taken out of the scene, paths track through the grid instead of hitting them.
+	// only called when the path kernel or the wavefront is the one integrator, the others still hit
+	// the primitives
+	volumes.clear();
+	for (int i = 0; i < materials.size(); i++) {
+		if (materials[i].type() != VOLUMETRIC) continue;
+		DensityGrid grid = Volumes::bake(primitives, i);
+		if (grid.density.empty()) continue;
+		volumes.push_back(std::move(grid));
+	}
+	if (volumes.empty()) return;
+	primitives.erase(std::remove_if(primitives.begin(), primitives.end(), [&](const Primitive& p) {
+		return p.material >= 0 && materials[p.material].type() == VOLUMETRIC;
+	}), primitives.end());
+}
+
+DirectLightData DirectLightAt(const Light& light, const glm::vec3& position, const Hit& hit, const Material& mat) {
+    // as if the light sat at position, for lights with extent sampled one point at a time
+    DirectLightData dld{};
+    dld.color = Spectrum(light.color);
+    glm::vec3 ld = glm::vec3(0.0f);
+    if (glm::length(light.direction) == 0.0f) { // point light
+        dld.d2l = glm::normalize(position - hit.p);
+        ld = dld.d2l;
+    } else if (light.penumbra == 0 && light.angle == 0) { // directional light
+        dld.d2l = glm::normalize(light.direction);
+        ld = dld.d2l;
+    } else { // spot light
+        dld.d2l = glm::normalize(position - hit.p);
+        ERROR("Not implemented yet!");
+    }
+    dld.diffuse = std::max(0.0f, glm::dot(hit.n, ld));
+    float highlight = std::max(0.0f, glm::dot(glm::normalize(jlm::reflect(ld, hit.n)), hit.d2c));
+    dld.specular = (dld.diffuse > 0)*(FastMath::enabled ? FastMath::pow(highlight, mat.shiny()) : std::pow(highlight, mat.shiny()));
+    return dld;
+}
+
+EmitterSample SamplePrimitive(const Primitive& p, glm::vec2 u2) {
+	// uniform over the primitive's surface
+	EmitterSample es{};
+	es.material = p.material;
+	if (p.type == SPHERE) {
+		float z = 1.0f - 2.0f * u2.x;
+		float r = std::sqrt(std::max(0.0f, 1.0f - z*z));
+		float phi = 2.0f * M_PI * u2.y;
+		float s, c;
+		if (FastMath::enabled) FastMath::sincos(phi, s, c);
+		else { s = std::sin(phi); c = std::cos(phi); }
+		es.n = glm::vec3(r * c, r * s, z);
+		es.p = p.v1 + p.v2.x * es.n;
+	} else {
+		float su = std::sqrt(u2.x);
+		float b1 = 1.0f - su;
+		float b2 = u2.y * su;
+		es.p = b1 * p.v1 + b2 * p.v2 + (1.0f - b1 - b2) * p.v3;
+		es.n = glm::normalize(glm::cross(p.v2 - p.v1, p.v3 - p.v1));
+	}
+	return es;
+}
+
+EmitterSample Scene::sampleEmitter(float u1, glm::vec2 u2) const {
+	int index = std::lower_bound(emitterCDF.begin(), emitterCDF.end(), u1) - emitterCDF.begin();
+	return SamplePrimitive(primitives[emitters[std::min(index, (int)emitters.size() - 1)]], u2);
+}
+
+void Scene::preparePhotons() {
+	// every light with an area and every emissive primitive, weighted by emitted flux. lights
+	// emit from one side, emissive primitives glow on both
+	photonSources.clear();
+	photonCDF.clear();
+	float total = 0.0f;
+	for (int i = 0; i < lights.size(); i++) {
+		if (!LightTree::emitter(lights[i])) continue;
+		PhotonSource source = { i, -1, Spectrum(lights[i].color), 0.0f };
+		source.flux = M_PI * lightGeometry[i].area * lightGeometry[i].emission;
+		photonSources.push_back(source);
+	}
+	for (int i = 0; i < emitters.size(); i++) {
+		const Primitive& p = primitives[emitters[i]];
+		float area = (emitterCDF[i] - (i > 0 ? emitterCDF[i - 1] : 0.0f)) * emitterArea;
+		PhotonSource source = { -1, emitters[i], Spectrum(materials[p.material].emission()), 0.0f };
+		float mean = 0.0f;
+		for (int j = 0; j < NMSAMPLES; j++) mean += std::max(0.0f, source.emission[j]) / NMSAMPLES;
+		source.flux = 2.0f * M_PI * area * mean;
+		photonSources.push_back(source);
+	}
+	for (const PhotonSource& source : photonSources) {
+		total += source.flux;
+		photonCDF.push_back(total);
+	}
+	for (int i = 0; i < photonCDF.size(); i++) photonCDF[i] /= total;
+	photonFlux = std::max(0.0f, total);
+	if (total <= 0.0f) {
+		photonSources.clear();
+		photonCDF.clear();
+	}
+}
+
+void Scene::tracePhoton(uint32_t pass, uint32_t index, std::vector<Photon>& photons) {
+	// one photon of the pass, followed through specular events until it lands on a diffuse
+	// surface. photons that land without passing anything specular are dropped, direct light
+	// is already sampled from the camera side
+	if (photonSources.empty()) return;
+	Sampler& sampler = Sampler::get();
+	sampler.start(PHOTON_STREAM, pass, index);
+
+	// EMISSION
+	float u = sampler.get1D();
+	int s = std::min((int)(std::lower_bound(photonCDF.begin(), photonCDF.end(), u) - photonCDF.begin()), (int)photonSources.size() - 1);
+	const PhotonSource& source = photonSources[s];
+	float pmf = photonCDF[s] - (s > 0 ? photonCDF[s - 1] : 0.0f);
+	glm::vec3 p, n;
+	if (source.light >= 0) {
+		LightSample ls = LightSampler::sampleArea(lights[source.light], lightGeometry[source.light], sampler.get2D());
+		p = ls.p;
+		n = ls.n;
+	} else {
+		EmitterSample es = SamplePrimitive(primitives[source.primitive], sampler.get2D());
+		p = es.p;
+		n = sampler.get1D() < 0.5f ? es.n : -es.n;
+	}
+	glm::vec3 d = glm::normalize(SampleUtils::onb(n, SampleUtils::hemisphereSample()));
+
+	// the wavelength is picked by emitted power, so every photon of a source leaves with the same power
+	float cdf[NMSAMPLES];
+	float sum = 0.0f;
+	for (int j = 0; j < NMSAMPLES; j++) {
+		sum += std::max(0.0f, source.emission[j]);
+		cdf[j] = sum;
+	}
+	if (sum <= 0.0f) return;
+	float v = sampler.get1D() * sum;
+	int wavelength = 0;
+	while (wavelength < NMSAMPLES - 1 && cdf[wavelength] <= v) wavelength++;
+	float power = source.flux * NMSAMPLES / (pmf * GlobalConfig::photonCount());
+	int tag = source.light >= 0 ? source.light : -1 - primitives[source.primitive].material;
+
+	// SPECULAR CHAIN
+	Ray ray = { p + d * EPSILON, d };
+	Medium medium = { 1.0f, 0, MaterialUtils::AirMaterial(), Spectrum(1.0f), wavelength, p };
+	bool specular = false;
+	while (medium.bounces < GlobalConfig::maxDepth()) {
+		Hit hit = intersect(ray);
+		if (hit.t <= 0.0f || hit.material == materials.size() - 1) return;
+		Material* m = hit.material < 0 ? MaterialUtils::DefaultMaterial() : &(materials[hit.material]);
+		if (m->emissive()) return;
+		if (m->type() == LAMBERTIAN) {
+			if (specular) photons.push_back({ hit.p, ray.d, power, medium.wavelength, tag });
+			return;
+		}
+		SampleList samples = m->sample(hit, medium);
+		if (samples.empty() || samples[0].pdf <= 0.0f) return;
+		const Sample& sample = samples[0];
+		bool volPass = m->type() == VOLUMETRIC && sample.delta;
+		power *= volPass ? sample.transmission : sample.color[medium.wavelength];
+		if (!(power > 0.0f)) return;
+		int next = medium.wavelength;
+		if (!m->convert().empty()) next = Spectrum::bin(m->convert().evaluate(Spectrum::wavelength(next)));
+		medium = (Medium){ sample.ior, medium.bounces + 1, volPass ? medium.material : MaterialUtils::continued(m, medium, sample), Spectrum(1.0f), next, hit.p };
+		ray = (Ray){ hit.p + sample.incoming * EPSILON, sample.incoming };
+		specular = true;
+	}
+}
+
 Hit Scene::intersect(const Ray& ray) const {
     Hit h{};
     h.t = -1.0f;
     if (bvh.size() == 0 || !BVH::intersect(ray, 0, bvh)) return h;
-    h = traverse(ray, 0);
+    glm::vec3 dfrac = glm::vec3(1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z);
+    switch (mix) {
+        case ONLY_TRIANGLES: h = traverse<ONLY_TRIANGLES>(ray, dfrac, 0); break;
+        case ONLY_SPHERES: h = traverse<ONLY_SPHERES>(ray, dfrac, 0); break;
+        default: h = traverse<MIXED_PRIMITIVES>(ray, dfrac, 0); break;
+    }
     h.d2c = glm::normalize(ray.p - h.p);
 	if (glm::dot(h.n, h.d2c) < 0.0f) h.n *= -1.0f; // comment out for more interesting outputs while raytracing diffraction
     h.d2r = glm::normalize(jlm::reflect(h.d2c, h.n));
@@ -71,23 +426,29 @@ Hit Scene::intersect2(const Ray& ray) const {
     Hit h{};
     h.t = -1.0f;
     if (lPrimitive.size() == 0 || !BVH::intersect(ray, 0, bvh2)) return h;
-    h = traverse2(ray, 0);
+    glm::vec3 dfrac = glm::vec3(1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z);
+    switch (mix2) {
+        case ONLY_TRIANGLES: h = traverse2<ONLY_TRIANGLES>(ray, dfrac, 0); break;
+        case ONLY_SPHERES: h = traverse2<ONLY_SPHERES>(ray, dfrac, 0); break;
+        default: h = traverse2<MIXED_PRIMITIVES>(ray, dfrac, 0); break;
+    }
     h.d2c = glm::normalize(ray.p - h.p);
 	if (glm::dot(h.n, h.d2c) < 0.0f) h.n *= -1.0f; // comment out for more interesting outputs while raytracing diffraction
     h.d2r = glm::normalize(jlm::reflect(h.d2c, h.n));
     return h;
 }
 
-Hit Scene::traverse(const Ray& ray, size_t ind) const {
-    NodeBVH node = bvh[ind];
-    if (node.config == BranchBVH::LEAF) return PrimitiveUtils::intersect(ray, primitives[node.left]);
+template <PrimitiveMix Mix>
+Hit Scene::traverse(const Ray& ray, const glm::vec3& dfrac, size_t ind) const {
+    const NodeBVH& node = bvh[ind];
+    if (node.config == BranchBVH::LEAF) return PrimitiveUtils::intersect<Mix>(ray, primitives[node.left]);
     Hit hl, hr;
     hl.t = -1.0f;
     hr.t = -1.0f;
     if (node.config == BranchBVH::LEFT || node.config == BranchBVH::BOTH)
-        if (BVH::intersect(ray, node.left, bvh)) hl = traverse(ray, node.left);
+        if (BVH::intersect(ray, dfrac, bvh[node.left])) hl = traverse<Mix>(ray, dfrac, node.left);
     if (node.config == BranchBVH::RIGHT || node.config == BranchBVH::BOTH)
-        if (BVH::intersect(ray, node.right, bvh)) hr = traverse(ray, node.right);
+        if (BVH::intersect(ray, dfrac, bvh[node.right])) hr = traverse<Mix>(ray, dfrac, node.right);
     Hit h;
     h.t = -1.0f;
     if (hl.t > 0 && (h.t < 0 || hl.t < h.t)) h = hl;
@@ -95,16 +456,17 @@ Hit Scene::traverse(const Ray& ray, size_t ind) const {
     return h;
 }
 
-Hit Scene::traverse2(const Ray& ray, size_t ind) const {
-    NodeBVH node = bvh2[ind];
-    if (node.config == BranchBVH::LEAF) return PrimitiveUtils::intersect(ray, lPrimitive[node.left]);
+template <PrimitiveMix Mix>
+Hit Scene::traverse2(const Ray& ray, const glm::vec3& dfrac, size_t ind) const {
+    const NodeBVH& node = bvh2[ind];
+    if (node.config == BranchBVH::LEAF) return PrimitiveUtils::intersect<Mix>(ray, lPrimitive[node.left]);
     Hit hl, hr;
     hl.t = -1.0f;
     hr.t = -1.0f;
     if (node.config == BranchBVH::LEFT || node.config == BranchBVH::BOTH)
-        if (BVH::intersect(ray, node.left, bvh2)) hl = traverse2(ray, node.left);
+        if (BVH::intersect(ray, dfrac, bvh2[node.left])) hl = traverse2<Mix>(ray, dfrac, node.left);
     if (node.config == BranchBVH::RIGHT || node.config == BranchBVH::BOTH)
-        if (BVH::intersect(ray, node.right, bvh2)) hr = traverse2(ray, node.right);
+        if (BVH::intersect(ray, dfrac, bvh2[node.right])) hr = traverse2<Mix>(ray, dfrac, node.right);
     Hit h;
     h.t = -1.0f;
     if (hl.t > 0 && (h.t < 0 || hl.t < h.t)) h = hl;
@@ -112,72 +474,87 @@ Hit Scene::traverse2(const Ray& ray, size_t ind) const {
     return h;
 }
 
-std::pair<float, float> getRandomPoint(std::uniform_real_distribution<> &dis, std::mt19937 &gen) {
-    return {(static_cast<float>(dis(gen))), (static_cast<float>(dis(gen)))};
-}
-
-std::vector<vertex> sampleSpherePoints(const Light& light, int samples, std::uniform_real_distribution<>& dis, std::mt19937& gen) {
-    std::vector<glm::vec3> positions;
-    auto center = light.position;
-    auto radius = light.radius;
-    int n = samples;
-    for (int i = 0; i < n; i++) {
-        float u1 = dis(gen);
-        float u2 = dis(gen);
-
-        float z = 1.0f - 2.0f * u1;
-        float r = sqrtf(1.0f - z*z);
-        float phi = 2.0f * M_PI * u2;
-        float x = r * cosf(phi);
-        float y = r * sinf(phi);
-        positions.push_back(center + radius * glm::vec3(x, y, z));
+template <PrimitiveMix Mix>
+uint32_t Scene::traverseShadows(const ShadowStream& stream, uint32_t active, size_t ind) const {
+    // the box is tested from the shared origin, which only ever lets in more rays than testing
+    // from each ray's own offset origin would. leaves test the same rays occluded(p, q) would
+    const NodeBVH& node = bvh[ind];
+    glm::vec3 lo = node.min - stream.p;
+    glm::vec3 hi = node.max - stream.p;
+    uint32_t inside = 0;
+    for (int i = 0; i < stream.count; i++) {
+        if (!((active >> i) & 1u)) continue;
+        const glm::vec3& dfrac = stream.dfrac[i];
+        float t1 = lo.x * dfrac.x;
+        float t2 = hi.x * dfrac.x;
+        float t3 = lo.y * dfrac.y;
+        float t4 = hi.y * dfrac.y;
+        float t5 = lo.z * dfrac.z;
+        float t6 = hi.z * dfrac.z;
+        float tmin = std::max(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
+        float tmax = std::min(std::min(std::max(t1, t2), std::max(t3, t4)), std::max(t5, t6));
+        if (!(tmax < 0 || tmin > tmax || tmin > stream.dist[i] + EPSILON)) inside |= 1u << i;
     }
-    return positions;
-}
-
-std::vector<vertex> sampleAreaLights(const Light& light, int samples, std::uniform_real_distribution<> &dis, std::mt19937 &gen) {
-    glm::vec3 pos = light.position;
-    std::vector<glm::vec3> positions;
-    int n = std::sqrt(samples);
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            auto p = getRandomPoint(dis, gen);
-            float u = (i + p.first) / n;
-            float v = (j + p.second) / n;
-            positions.push_back(pos + u * vertex(light.wvec) + v * vertex(light.hvec));
+    if (inside == 0) return 0;
+    if (node.config == BranchBVH::LEAF) {
+        uint32_t blocked = 0;
+        for (int i = 0; i < stream.count; i++) {
+            if (!((inside >> i) & 1u)) continue;
+            float t = PrimitiveUtils::intersect<Mix>({ stream.p + stream.d[i] * EPSILON, stream.d[i] }, primitives[node.left]).t;
+            if (t > 0.0f && t < stream.dist[i]) blocked |= 1u << i;
         }
+        return blocked;
     }
-    return positions;
+    // any hit blocks a shadow ray, so a ray blocked on the left is not traced on the right
+    uint32_t blocked = 0;
+    if (node.config == BranchBVH::LEFT || node.config == BranchBVH::BOTH)
+        blocked |= traverseShadows<Mix>(stream, inside, node.left);
+    if ((node.config == BranchBVH::RIGHT || node.config == BranchBVH::BOTH) && (inside & ~blocked))
+        blocked |= traverseShadows<Mix>(stream, inside & ~blocked, node.right);
+    return blocked;
 }
 
-Spectrum Scene::rayColor(const Hit& hit, const Medium& medium, int recur) {
+// queues a child of a ray tree branch, unless the budget is spent or too little of its light could
+// reach the pixel to matter
+static inline void queueBranch(std::vector<RayBranch>& tree, const RayBranch& parent, const Ray& ray, const Medium& medium, const Spectrum& weight, const int* bins) {
+    if (tree.size() >= (size_t)std::max(1, GlobalConfig::rayBudget())) return;
+    if ((weight * medium.throughput).max() < RAYTRACE_CUTOFF) return;
+    RayBranch branch = { ray, medium, parent.depth + 1, weight };
+    for (int j = 0; j < NMSAMPLES; j++) branch.bins[j] = bins[j];
+    tree.push_back(branch);
+}
+
+void Scene::rayColor(const Hit& hit, const RayBranch& branch, std::vector<RayBranch>& tree, Spectrum& radiance) {
+    const Medium& medium = branch.medium;
     Material* m = hit.material < 0 ? MaterialUtils::DefaultMaterial() : &(materials[hit.material]);
     // DIRECT LIGHTING
     Spectrum s = m->ambient().spectrum();
     for (int i = 0; i < lights.size(); i++) {
-        if (glm::length(lights[i].hvec) != 0.0f) {
-            auto lightPositions = sampleAreaLights(lights[i], 100, dis, gen);
-            Spectrum aggregate(0.0);
-            for (const auto &p : lightPositions) {
-                Light sampleLight = lights[i];
-                sampleLight.position = p;
-                DirectLightData dld = SceneUtils::directLight(sampleLight, hit, *m);
-                auto t = intersect({ hit.p + dld.d2l * EPSILON, dld.d2l }).t;
-                if (t <= 0.0f || t > hit.t) {
-                    aggregate += Spectrum(m->absorb()) *
-                        dld.color *
-                           (m->diffuse().evaluate(dld.diffuse) +
-                            m->specular().evaluate(dld.specular));
-                }
-            }
-            s += aggregate / lightPositions.size();
-        } else {
-            DirectLightData dld = SceneUtils::directLight(lights[i], hit, *m);
-            if (intersect((Ray){ hit.p + dld.d2l*EPSILON, dld.d2l }).t <= 0.0f) {
-                s += (Spectrum(m->absorb()) * dld.color * (m->diffuse().evaluate(dld.diffuse) + m->specular().evaluate(dld.specular)));
-            }
+        if (LightTree::emitter(lights[i])) continue;
+        DirectLightData dld = SceneUtils::directLight(lights[i], hit, *m);
+        if (intersect((Ray){ hit.p + dld.d2l*EPSILON, dld.d2l }).t <= 0.0f) {
+            s += (Spectrum(m->absorb()) * dld.color * (m->diffuse().evaluate(dld.diffuse) + m->specular().evaluate(dld.specular)));
+        }
+    }
+
+    // lights with extent share one budget, each sample picks a light through the light tree
+    // and stands in for a point light on it (these lights do not fall off in raytrace mode). a
+    // sphere light stands in for the point light at its centre, as it always has here, since
+    // sphere lights are not in the BVH and a point on the far side would light through the sphere
+    Sampler& sampler = Sampler::get();
+    uint32_t dimension = sampler.reserve(3);
+    for (int i = 0; i < RAYTRACE_LIGHT_SAMPLES && lightTree.size() > 0; i++) {
+        float pmf;
+        int li = LightTree::sample(lightTree, hit.p, hit.n, sampler.get1D(dimension + 2, i, RAYTRACE_LIGHT_SAMPLES), pmf, false);
+        if (li < 0) continue;
+        glm::vec2 u = sampler.get2D(dimension, i, RAYTRACE_LIGHT_SAMPLES);
+        glm::vec3 position = lights[li].radius > 0.0f ? lights[li].position : LightSampler::sampleArea(lights[li], lightGeometry[li], u).p;
+        DirectLightData dld = DirectLightAt(lights[li], position, hit, *m);
+        auto t = intersect({ hit.p + dld.d2l * EPSILON, dld.d2l }).t;
+        if (t <= 0.0f || t > hit.t) {
+            s += Spectrum(m->absorb()) * dld.color *
+                (m->diffuse().evaluate(dld.diffuse) + m->specular().evaluate(dld.specular)) / (pmf * RAYTRACE_LIGHT_SAMPLES);
         }
-        
     }
 
 	// UPDATE THROUGHPUT
@@ -185,6 +562,18 @@ Spectrum Scene::rayColor(const Hit& hit, const Medium& medium, int recur) {
 	Spectrum newT = medium.throughput * Spectrum(m->absorb());
 	int newbounces = medium.bounces + 1;
 
+    // CONVERSION
+    // what this branch gathers is converted and then absorbed once more on its way out, so the
+    // weight it and its children carry to the pixel folds that in ahead of the parent's
+    Spectrum weight;
+    int bins[NMSAMPLES];
+    for (int j = 0; j < NMSAMPLES; j++) {
+        int c = Spectrum::bin(m->convert().evaluate(Spectrum::wavelength(j)));
+        weight[j] = medium.throughput[c] * branch.weight[c];
+        bins[j] = branch.bins[c];
+    }
+    deposit(radiance, s * weight, bins, nullptr, 0);
+
     // REFLECTION/REFRACTION
     if (m->type() == DIELECTRIC && medium.bounces < GlobalConfig::maxDepth()) {
         Spectrum split = Spectrum(0.0f);
@@ -192,137 +581,814 @@ Spectrum Scene::rayColor(const Hit& hit, const Medium& medium, int recur) {
             split[i] = Optics::DielectricFresnel(hit.d2c, hit.n, medium.ior, m->ior().evaluate(Spectrum::wavelength(i)));
         }
         glm::vec3 reflect_dir = glm::normalize(jlm::reflect(hit.d2c, hit.n));
-        Spectrum reflected = shade((Ray){ hit.p + reflect_dir*EPSILON, reflect_dir }, (Medium){ medium.ior, newbounces, m, newT, medium.wavelength, hit.p }, recur + 1) * split;
-        Spectrum refracted = Spectrum(0.0f);
+        queueBranch(tree, branch, (Ray){ hit.p + reflect_dir*EPSILON, reflect_dir }, (Medium){ medium.ior, newbounces, medium.material, newT, medium.wavelength, hit.p }, weight * split, bins);
         for (int i = 0; i < NMSAMPLES; i++) {
 			if (medium.wavelength < NMSAMPLES) i = medium.wavelength;
 			Material* newm = m == medium.material ? MaterialUtils::AirMaterial() : m;
             float ior = newm->ior().evaluate(Spectrum::wavelength(i));
             if (ior > 0.0f) {
                 glm::vec3 refract_dir = glm::normalize(glm::refract(hit.d2c, hit.n, medium.ior / ior));
-                refracted[i] += shade((Ray){ hit.p + refract_dir*EPSILON, refract_dir }, (Medium){ ior, newbounces, newm, newT, i, hit.p }, recur + 1)[i] * (1.0f - split[i]);
+                queueBranch(tree, branch, (Ray){ hit.p + refract_dir*EPSILON, refract_dir }, (Medium){ ior, newbounces, newm, newT, i, hit.p },
+                    Spectrum::isolate(weight * (Spectrum(1.0f) - split), i), bins);
             }
 			if (medium.wavelength < NMSAMPLES) break;
         }
-        s += (refracted + reflected);
     }
+}
+
+
 
-    // CONVERSION
-    s.translate(m->convert());
 
-    return s*medium.throughput;
+static inline float mean(const Spectrum& s) {
+    float total = 0.0f;
+    for (int j = 0; j < NMSAMPLES; j++) total += s[j];
+    return total / NMSAMPLES;
 }
 
+// a diffuse bounce waiting to learn how much light came back along its direction
+struct GuideVertex {
+    glm::vec3 p;
+    glm::vec3 n;
+    glm::vec3 d;
+    float pdf;
+    int depth;
+    float throughput; // after the bounce
+    float radiance;   // path radiance when the bounce was taken, and whatever the guide should not learn
+};
 
+// a diffuse vertex waiting to learn how much light the rest of the path gathered
+struct CacheVertex {
+    glm::vec3 p;
+    glm::vec3 n;
+    Spectrum throughput; // arriving at the vertex
+    Spectrum radiance;   // path radiance on arrival
+};
 
+// what a path carries besides its state, read once per path rather than on every vertex. the
+// wavefront leaves out whatever it does not run
+struct PathContext {
+    int minDepth;
+    int maxDepth;
+    bool sampleEmitters;
+    std::vector<Spectrum>* aov;
+    const Reservoir* reservoir;
+    const PhotonMap* photons;
+    GuideVertex* vertices; // recorded for the guide while it trains
+    int recorded;
+    CacheVertex* arrivals; // recorded for the cache while it warms
+    int arrived;
+};
 
-Spectrum Scene::pathColor(const Hit& hit, const Medium& medium, int recur) {
-    Material* m = hit.material < 0 ? MaterialUtils::DefaultMaterial() : &(materials[hit.material]);
+Spectrum Scene::pathColor(const Ray& cameraRay, std::vector<Spectrum>* aov, const Reservoir* reservoir, const PhotonMap* photons, std::vector<GuideRecord>* records, std::vector<CacheRecord>* cached) {
+    // the kernel compiled for what the scene holds, prepareKernels() picked it when the scene loaded
+    switch (features) {
+        case 0: return pathKernel<0>(cameraRay, aov, reservoir, photons, records, cached);
+        case 1: return pathKernel<1>(cameraRay, aov, reservoir, photons, records, cached);
+        case 2: return pathKernel<2>(cameraRay, aov, reservoir, photons, records, cached);
+        case 3: return pathKernel<3>(cameraRay, aov, reservoir, photons, records, cached);
+        case 4: return pathKernel<4>(cameraRay, aov, reservoir, photons, records, cached);
+        case 5: return pathKernel<5>(cameraRay, aov, reservoir, photons, records, cached);
+        case 6: return pathKernel<6>(cameraRay, aov, reservoir, photons, records, cached);
+        default: return pathKernel<FEATURE_ALL>(cameraRay, aov, reservoir, photons, records, cached);
+    }
+}
 
-	// EMISSION
-	if (m->emissive()) return medium.throughput * m->emission();
+template <int Features>
+Spectrum Scene::pathKernel(const Ray& cameraRay, std::vector<Spectrum>* aov, const Reservoir* reservoir, const PhotonMap* photons, std::vector<GuideRecord>* records, std::vector<CacheRecord>* cached) {
+    Spectrum radiance = Spectrum(0.0f);
+    GuideVertex vertices[GUIDE_VERTICES];
+    CacheVertex arrivals[CACHE_VERTICES];
+    // read once per path rather than on every bounce
+    PathContext context = { GlobalConfig::minDepth(), GlobalConfig::maxDepth(),
+        (Features & FEATURE_EMITTERS) && GlobalConfig::emitterSampling() && emitters.size() > 0,
+        aov, reservoir, photons, records ? vertices : nullptr, 0, cached ? arrivals : nullptr, 0 };
+    VertexLight light;
 
-	// PATH
-    Spectrum s = Spectrum(0.0f);
-    int samp = 25;
-    for (auto light : lights) {
-        if (recur != 0) break;
-
-        // assuming area lights
-        if (light.radius == 0.0f) {
-            auto lightPositions = sampleAreaLights(light, samp, dis, gen);
-            for (const auto &point : lightPositions) {
-                glm::vec3 direction = point - hit.p;
-                glm::vec3 dirNorm = glm::normalize(direction);
-                float dist = glm::length(direction);
-                glm::vec3 lightNormal = glm::normalize(glm::cross(light.wvec, light.hvec));
-                float cosTheta = glm::dot(hit.n, dirNorm);
-                float cosLight = glm::dot(-dirNorm, lightNormal);
-                if (cosLight <= 0.0f || cosTheta <= 0.0f) {
-                    continue;
+    // paths only branch when a diffracting dielectric splits an unresolved wavelength, which
+    // happens at most once per path, so the pending branches always fit in NMSAMPLES states
+    PathState stack[NMSAMPLES];
+    int top = 0;
+    PathState& root = stack[top++];
+    root.ray = cameraRay;
+    root.medium = (Medium){ 1.0f, 0, MaterialUtils::AirMaterial(), Spectrum(1.0f), NMSAMPLES, cameraRay.p };
+    root.depth = 0;
+    root.roulette = false;
+    root.specular = true;
+    root.diffuse = false;
+    root.pdf = 0.0f;
+    for (int j = 0; j < NMSAMPLES; j++) root.bins[j] = j;
+
+    while (top > 0) {
+        PathState path = stack[--top];
+        context.recorded = 0;
+        context.arrived = 0;
+        bool split = false;
+        while (true) {
+            // RUSSIAN ROULETTE
+            if (path.roulette) {
+                float p = CLAMP(path.medium.throughput.max(), 0.05f, 1.0f);
+                if (Sampler::get().get1D() > p) break;
+                path.medium.throughput /= p;
+            }
+
+            Hit hit = intersect(path.ray);
+            if (path.depth == 0) {
+                Hit h1 = intersect2(path.ray);
+                if (h1.t > 0.0 && (h1.t < hit.t || hit.t <= 0.0f)) hit = h1;
+            }
+
+            PathState next[NMSAMPLES];
+            int branches = shadeVertex<Features>(path, hit, context, light, false, radiance, next);
+            if (branches == 0) break;
+            split = (Features & FEATURE_DIFFRACTION) && (split || branches > 1);
+
+            // continue with the first branch, the rest wait on the stack in depth first order
+            if (Features & FEATURE_DIFFRACTION) {
+                ASSERT(top + branches - 1 <= NMSAMPLES, "Path branch stack overflow");
+                for (int i = branches - 1; i > 0; i--) stack[top++] = next[i];
+            }
+            path = next[0];
+        }
+
+        // GUIDE RECORDS
+        // whatever the path gathered after a diffuse bounce arrived along that bounce's direction
+        if (records) {
+            float total = mean(radiance);
+            for (int i = 0; i < context.recorded; i++) {
+                const GuideVertex& v = vertices[i];
+                if (v.throughput <= 0.0f || v.pdf <= 0.0f) continue;
+                records->push_back({ v.p, v.n, v.d, (total - v.radiance) / (v.throughput * v.pdf) });
+            }
+        }
+
+        // CACHE RECORDS
+        // branches left on the stack would still add to what a vertex gathered, so paths that
+        // split are not recorded
+        if (cached && !split) {
+            for (int i = 0; i < context.arrived; i++) {
+                CacheRecord r = { arrivals[i].p, arrivals[i].n, Spectrum(0.0f), 0 };
+                for (int j = 0; j < NMSAMPLES; j++) {
+                    if (!(arrivals[i].throughput[j] > 0.0f)) continue;
+                    r.radiance[j] = (radiance[j] - arrivals[i].radiance[j]) / arrivals[i].throughput[j];
+                    r.bins |= 1u << j;
                 }
-                float t = intersect({ hit.p + dirNorm * EPSILON, dirNorm}).t;
-                if (t >= 0.0 && t < dist) continue;
-                float area = glm::length(glm::cross(light.wvec, light.hvec));
-                
-                Spectrum diffuse = Spectrum(light.color) * m->diffuse().evaluate(cosTheta) / M_PI;
-                float factor = area / (dist * dist);
-                s += diffuse * cosLight * factor * medium.throughput / lightPositions.size();
+                if (r.bins) cached->push_back(r);
             }
-        } else {
-            auto lightPositions = sampleSpherePoints(light, samp, dis, gen);
-            for (const auto &point : lightPositions) {
-                glm::vec3 direction = point - hit.p;
-                glm::vec3 dirNorm = glm::normalize(direction);
+        }
+    }
+    return radiance;
+}
+
+template <int Features>
+int Scene::shadeVertex(const PathState& path, const Hit& hit, PathContext& context, VertexLight& light, bool defer, Spectrum& radiance, PathState* next) {
+    // one vertex of a path, for the path kernel and the wavefront alike. what it gathers goes into
+    // radiance, the light it samples is gathered once its shadow rays are traced, straight away
+    // unless it is told to defer them. the paths it continues along go into next, and it returns
+    // how many, 0 once the path ends
+    const Medium& medium = path.medium;
+    std::vector<Spectrum>* aov = context.aov;
+    light.stream.count = 0;
+    light.pending = false;
+    light.attenuated = (Features & FEATURE_VOLUMES) != 0;
+
+    // VOLUMES
+    // a collision inside a medium before the surface scatters the path there instead
+    float collision;
+    int volume;
+    if ((Features & FEATURE_VOLUMES) && Volumes::track(volumes, path.ray, hit.t > 0.0f ? hit.t : FLT_MAX, collision, volume)) {
+        const Material& fog = materials[volumes[volume].material];
+        Hit event{};
+        event.t = collision;
+        event.p = path.ray.p + path.ray.d * collision;
+        event.d2c = -path.ray.d;
+        event.material = volumes[volume].material;
+        Spectrum albedo = Spectrum(fog.absorb());
+        if (path.depth == 0 && lightTree.size() > 0) {
+            // the lights are sampled as from a surface, weighted by the phase function and
+            // whatever of the medium lies between
+            Sampler& sampler = Sampler::get();
+            uint32_t dimension = sampler.reserve(3);
+            light.stream.p = event.p;
+            for (int j = 0; j < NMSAMPLES; j++) light.bins[j] = path.bins[j];
+            for (int i = 0; i < LIGHT_SAMPLES; i++) {
+                float pmf;
+                int li = LightTree::sample(lightTree, event.p, glm::vec3(0.0f),
+                    sampler.get1D(dimension + 2, i, LIGHT_SAMPLES), pmf);
+                if (li < 0) continue;
+                LightSample ls;
+                if (!LightSampler::sample(lights[li], lightGeometry[li], event.p, sampler.get2D(dimension, i, LIGHT_SAMPLES), ls)) continue;
+                glm::vec3 direction = ls.p - event.p;
                 float dist = glm::length(direction);
-                glm::vec3 lightNormal = glm::normalize(point - light.position);
-                float cosTheta = glm::dot(hit.n, dirNorm);
-                float cosLight = glm::dot(-dirNorm, lightNormal);
-                if (hit.material == materials.size() - 1) {
-                    cosLight = -cosLight;
-                    cosTheta = -cosTheta;
-                }
-                if (cosLight <= 0.0f || cosTheta <= 0.0f) {
-                    continue;
-                }
-                float t = intersect({ hit.p + dirNorm * EPSILON, dirNorm}).t;
-                if (t >= 0.0 && t < dist) {
-                    continue;
-                }
-                float area = 4.0f * M_PI * light.radius * light.radius;
-                Spectrum diffuse = Spectrum(light.color) * m->diffuse().evaluate(cosTheta) / M_PI;
-                float factor = area / (dist * dist);
-                s += diffuse * cosLight * factor * medium.throughput / lightPositions.size();
+                glm::vec3 dirNorm = direction / dist;
+                float phase = HenyeyGreenstein(glm::dot(path.ray.d, dirNorm), VOLUME_ANISOTROPY);
+                light.shaded[light.stream.count] = Spectrum(lights[li].color) * albedo * medium.throughput * (phase / (ls.pdf * pmf * LIGHT_SAMPLES));
+                light.sources[light.stream.count] = li;
+                streamShadow(light.stream, dirNorm, dist);
             }
+            if (!defer) gatherLight(light, radiance, aov);
         }
+        if (medium.bounces >= context.maxDepth) return 0;
+        // the phase function is sampled exactly, so it cancels out of the weight and only
+        // the albedo is left
+        glm::vec2 u = Sampler::get().get2D();
+        float pdf;
+        glm::vec3 scattered = sampleHG(event.d2c, VOLUME_ANISOTROPY, u.x, u.y, &pdf);
+        if (!(pdf > 0.0f)) return 0;
+        PathState& scatter = next[0];
+        scatter = path;
+        scatter.ray = (Ray){ event.p, scattered };
+        scatter.roulette = medium.bounces > context.minDepth;
+        scatter.medium.throughput *= albedo;
+        scatter.medium.bounces++;
+        scatter.depth++;
+        scatter.specular = true;
+        scatter.pdf = pdf;
+        return 1;
     }
-    if (hit.material == materials.size() - 1) {
-        s.translate(m->convert());
-        return s;
-    }
-	std::vector<Sample> samples = m->sample(hit, medium);
-	for (int i = 0; i < samples.size(); i++) {
-		if (samples[i].pdf > 0 && medium.bounces < GlobalConfig::maxDepth()) {
-			float cosTheta = std::max(0.0f, glm::dot(samples[i].incoming, hit.n));
-            bool volPass = (m->type() == VOLUMETRIC) && samples[i].delta;
-            Spectrum newT = medium.throughput * (volPass ? Spectrum(samples[i].transmission)
-                : (samples[i].color * (samples[i].delta ? 1.0f
-                : cosTheta / samples[i].pdf)));
-
-			// RUSSIAN ROULETTE
-			bool recurse = true;
-			if (medium.bounces > GlobalConfig::minDepth()) {
-				float p = CLAMP(newT.max(), 0.05f, 1.0f);
-				if (jlm::random01() > p) recurse = false;
-				else newT /= p;
-			} 
-			if (recurse) s += shade(
-					(Ray){ hit.p + samples[i].incoming*EPSILON, samples[i].incoming },
-					(Medium){ samples[i].ior, medium.bounces + 1, volPass ? medium.material : m, newT, samples[i].wavelength, hit.p }, recur + 1);
-		}
-	}
 
-	// CONVERSION
-	s.translate(m->convert());
+    if (hit.t <= 0.0f) {
+        if (!((Features & FEATURE_VOLUMES) && medium.material->type() == VOLUMETRIC) && medium.material != MaterialUtils::AirMaterial()) {
+            // DIRECT LIGHTING ON MISS
+            Hit h2{};
+            h2.n = path.ray.d;
+            h2.p = path.ray.p;
+            for (int i = 0; i < lights.size(); i++) {
+                DirectLightData dld = SceneUtils::directLight(lights[i], h2, *medium.material);
+                deposit(radiance, dld.color * medium.material->diffuse().evaluate(dld.diffuse) * medium.throughput, path.bins, aov, i);
+            }
+        }
+        return 0;
+    }
+    Material* m = hit.material < 0 ? MaterialUtils::DefaultMaterial() : &(materials[hit.material]);
 
-	return s;
+    // EMISSION
+    if (m->emissive()) {
+        // caustics on diffuse surfaces are gathered from the photons instead
+        if (context.photons && path.specular && path.diffuse) return 0;
+        float weight = 1.0f;
+        if (!path.specular && context.sampleEmitters) {
+            // MIS against the emitter sample the previous vertex already took
+            float cosLight = std::abs(glm::dot(hit.n, path.ray.d));
+            float lightPdf = cosLight > 0.0f ? hit.t * hit.t / (cosLight * emitterArea) : 0.0f;
+            weight = (path.pdf * path.pdf) / (path.pdf * path.pdf + lightPdf * lightPdf);
+        }
+        deposit(radiance, medium.throughput * m->emission() * weight, path.bins, aov, aov && hit.material >= 0 ? aovmap[hit.material] : 0);
+
+        // emitter sampling already finds emitters a diffuse bounce can see, the guide is left
+        // to learn the light it cannot reach, such as caustics through dielectrics
+        GuideVertex* last = context.recorded > 0 ? &context.vertices[context.recorded - 1] : nullptr;
+        if (!path.specular && last && last->depth == path.depth - 1) {
+            last->radiance += mean(medium.throughput * m->emission() * weight);
+        }
+        return 0;
+    }
+
+    // CONVERSION
+    // everything gathered from here on is converted by this material first
+    int bins[NMSAMPLES];
+    if (m->convert().empty()) {
+        for (int j = 0; j < NMSAMPLES; j++) bins[j] = path.bins[j];
+    } else {
+        for (int j = 0; j < NMSAMPLES; j++) bins[j] = path.bins[Spectrum::bin(m->convert().evaluate(Spectrum::wavelength(j)))];
+    }
+    for (int j = 0; j < NMSAMPLES; j++) light.bins[j] = bins[j];
+
+    // DIRECT LIGHTING
+    // a fixed budget shared by every light, each sample picks a light through the light tree
+    bool flipped = hit.material == materials.size() - 1;
+    // a jittered sample only reuses the reservoir where it hit the surface the pixel centre
+    // did, anywhere else W says nothing about the light and it falls back to the light tree
+    const Reservoir* reservoir = context.reservoir;
+    bool resampled = path.depth == 0 && reservoir && !flipped
+        && ReSTIRUtils::similar(hit.n, hit.p, reservoir->normal, reservoir->origin, path.ray.p);
+    if (resampled) {
+        // one shadow ray towards the point the pixel's reservoir settled on
+        if (reservoir->W > 0.0f) {
+            const Light& l = lights[reservoir->light];
+            glm::vec3 direction = reservoir->p - hit.p;
+            float dist = glm::length(direction);
+            glm::vec3 dirNorm = direction / dist;
+            float cosTheta = glm::dot(hit.n, dirNorm);
+            float cosLight = -glm::dot(reservoir->n, dirNorm);
+            if (cosTheta > 0.0f && cosLight > 0.0f && !occluded(hit.p, reservoir->p)) {
+                Spectrum diffuse = Spectrum(l.color) * m->diffuse().evaluate(cosTheta) / M_PI;
+                deposit(radiance, diffuse * medium.throughput * (cosLight / (dist * dist) * reservoir->W), bins, aov, reservoir->light);
+            }
+        }
+    } else if (path.depth == 0 && lightTree.size() > 0) {
+        // every sample is picked first, then their shadow rays are traced as one stream
+        Sampler& sampler = Sampler::get();
+        uint32_t dimension = sampler.reserve(3);
+        light.stream.p = hit.p;
+        for (int i = 0; i < LIGHT_SAMPLES; i++) {
+            float pmf;
+            int li = LightTree::sample(lightTree, hit.p, flipped ? glm::vec3(0.0f) : hit.n,
+                sampler.get1D(dimension + 2, i, LIGHT_SAMPLES), pmf);
+            if (li < 0) continue;
+            const Light& l = lights[li];
+            glm::vec2 u = sampler.get2D(dimension, i, LIGHT_SAMPLES);
+            LightSample ls;
+            bool inside = flipped && l.radius > 0.0f;
+            if (inside) {
+                // the proxy around a sphere light glows with the far half of the light behind it
+                ls = LightSampler::sampleArea(l, lightGeometry[li], u);
+                glm::vec3 d = ls.p - hit.p;
+                float dist2 = glm::dot(d, d);
+                float cosLight = glm::dot(d, ls.n) / std::sqrt(dist2);
+                if (cosLight <= 0.0f) continue;
+                ls.pdf *= dist2 / cosLight;
+            } else if (!LightSampler::sample(l, lightGeometry[li], hit.p, u, ls)) {
+                continue;
+            }
+            glm::vec3 direction = ls.p - hit.p;
+            float dist = glm::length(direction);
+            glm::vec3 dirNorm = direction / dist;
+            float cosTheta = glm::dot(hit.n, dirNorm);
+            if (inside) cosTheta = -cosTheta;
+            if (cosTheta <= 0.0f) continue;
+            Spectrum diffuse = Spectrum(l.color) * m->diffuse().evaluate(cosTheta) / M_PI;
+            light.shaded[light.stream.count] = diffuse * medium.throughput / (ls.pdf * pmf * LIGHT_SAMPLES);
+            light.sources[light.stream.count] = li;
+            streamShadow(light.stream, dirNorm, dist);
+        }
+        if (!defer) gatherLight(light, radiance, aov);
+    }
+    if (flipped) return 0;
+
+    // RADIANCE CACHE
+    // past the first diffuse bounce the rest of the path is read from the cache. the
+    // scene's lights are only sampled at the first vertex, so the cache never holds their
+    // direct light. paths that went through a conversion are not recorded
+    if (m->type() == LAMBERTIAN && path.diffuse) {
+        Spectrum gathered;
+        if (Caching::lookup(cache, hit.p, hit.n, gathered)) {
+            deposit(radiance, medium.throughput * gathered, bins, aov, 0);
+            return 0;
+        }
+        bool unconverted = context.arrivals && context.arrived < CACHE_VERTICES;
+        for (int j = 0; j < NMSAMPLES && unconverted; j++) unconverted = bins[j] == j;
+        if (unconverted) context.arrivals[context.arrived++] = { hit.p, hit.n, medium.throughput, radiance };
+    }
+
+    // PHOTONS
+    // density estimate over the photons within the pass's radius that arrived from this side
+    const PhotonMap* photons = context.photons;
+    if (photons && m->type() == LAMBERTIAN) {
+        int ranges[16];
+        int count = PhotonMapping::lookup(*photons, hit.p, ranges);
+        float r2 = photons->radius * photons->radius;
+        Spectrum albedo = Spectrum(m->absorb());
+        for (int c = 0; c < count; c++) {
+            for (int k = ranges[2*c]; k < ranges[2*c + 1]; k++) {
+                const Photon& photon = photons->photons[k];
+                glm::vec3 offset = photon.p - hit.p;
+                float cosTheta = -glm::dot(photon.d, hit.n);
+                if (glm::dot(offset, offset) > r2 || cosTheta <= 0.0f) continue;
+
+                // the same reflectance the camera side uses when it samples that kind of light
+                float f = photon.source >= 0 ? m->diffuse().evaluate(cosTheta) / (cosTheta * M_PI)
+                    : albedo[photon.wavelength] / M_PI;
+                Spectrum e = Spectrum(0.0f);
+                e[photon.wavelength] = f * photon.power / (M_PI * r2);
+                deposit(radiance, medium.throughput * e, bins, aov,
+                    aov ? (photon.source >= 0 ? photon.source : aovmap[-1 - photon.source]) : 0);
+            }
+        }
+    }
+
+    // diffuse bounces mix the guide's learned incident light in with cosine sampling
+    const DirectionTree* guided = m->type() == LAMBERTIAN ? Guiding::lookup(guide, hit.p, hit.n) : nullptr;
+
+    // EMITTER SAMPLING
+    if (context.sampleEmitters && m->type() == LAMBERTIAN && medium.bounces < context.maxDepth) {
+        float u1 = Sampler::get().get1D();
+        EmitterSample es = sampleEmitter(u1, Sampler::get().get2D());
+        glm::vec3 direction = es.p - hit.p;
+        float dist = glm::length(direction);
+        glm::vec3 dirNorm = direction / dist;
+        float cosTheta = glm::dot(hit.n, dirNorm);
+        float cosLight = std::abs(glm::dot(es.n, dirNorm));
+        if (cosTheta > 0.0f && cosLight > 0.0f) {
+            float lightPdf = dist * dist / (cosLight * emitterArea);
+            float bsdfPdf = cosTheta / M_PI;
+            if (guided) bsdfPdf = GUIDE_FRACTION * Guiding::pdf(*guided, dirNorm) + (1.0f - GUIDE_FRACTION) * bsdfPdf;
+            float weight = (lightPdf * lightPdf) / (lightPdf * lightPdf + bsdfPdf * bsdfPdf);
+            Spectrum f = Spectrum(m->absorb()) / M_PI;
+            light.emitter = { hit.p + dirNorm * EPSILON, dirNorm };
+            light.limit = dist * (1.0f - EPSILON) - EPSILON;
+            light.emitted = medium.throughput * f * materials[es.material].emission() * (cosTheta * weight / lightPdf);
+            light.source = aov ? aovmap[es.material] : 0;
+            light.pending = true;
+            if (!defer) gatherLight(light, radiance, aov);
+        }
+    }
+
+    // PATH
+    SampleList samples;
+    if (guided && Sampler::get().get1D() < GUIDE_FRACTION) {
+        glm::vec3 wi = Guiding::sample(*guided, Sampler::get().get2D());
+        samples.push_back((Sample){ wi, 0.0f, Spectrum(m->absorb()) / M_PI, false, medium.wavelength, medium.ior });
+    } else {
+        samples = m->sample(hit, medium);
+    }
+    if (guided) {
+        float cosTheta = glm::dot(samples[0].incoming, hit.n);
+        samples[0].pdf = cosTheta > 0.0f ? GUIDE_FRACTION * Guiding::pdf(*guided, samples[0].incoming)
+            + (1.0f - GUIDE_FRACTION) * cosTheta / M_PI : 0.0f;
+    }
+    // only a diffracting dielectric ever returns more than one sample
+    int count = (Features & FEATURE_DIFFRACTION) ? (int)samples.size() : std::min((int)samples.size(), 1);
+    int branches = 0;
+    for (int i = 0; i < count; i++) {
+        if (samples[i].pdf > 0 && medium.bounces < context.maxDepth) {
+            float cosTheta = std::max(0.0f, glm::dot(samples[i].incoming, hit.n));
+            bool volPass = (Features & FEATURE_VOLUMES) && (m->type() == VOLUMETRIC) && samples[i].delta;
+            PathState& branch = next[branches++];
+            branch.ray = (Ray){ hit.p + samples[i].incoming*EPSILON, samples[i].incoming };
+            branch.medium = (Medium){ samples[i].ior, medium.bounces + 1, volPass ? medium.material : MaterialUtils::continued(m, medium, samples[i]),
+                medium.throughput * (volPass ? Spectrum(samples[i].transmission)
+                    : (samples[i].color * (samples[i].delta ? 1.0f
+                    : cosTheta / samples[i].pdf))),
+                samples[i].wavelength, hit.p };
+            branch.depth = path.depth + 1;
+            branch.roulette = medium.bounces > context.minDepth;
+            branch.specular = samples[i].delta;
+            branch.diffuse = path.diffuse || m->type() == LAMBERTIAN;
+            branch.pdf = samples[i].pdf;
+            for (int j = 0; j < NMSAMPLES; j++) branch.bins[j] = bins[j];
+        }
+    }
+    if (branches > 0 && context.vertices && m->type() == LAMBERTIAN && context.recorded < GUIDE_VERTICES) {
+        context.vertices[context.recorded++] = { hit.p, hit.n, next[0].ray.d, next[0].pdf, path.depth, mean(next[0].medium.throughput), mean(radiance) };
+    }
+    return branches;
 }
 
-DirectLightData SceneUtils::directLight(const Light& light, const Hit& hit, const Material& mat) {
-    DirectLightData dld{};
-    dld.color = Spectrum(light.color);
-    glm::vec3 ld = glm::vec3(0.0f);
-    if (glm::length(light.direction) == 0.0f) { // point light
-        dld.d2l = glm::normalize(light.position - hit.p);
-        ld = dld.d2l;
-    } else if (light.penumbra == 0 && light.angle == 0) { // directional light
-        dld.d2l = glm::normalize(light.direction);
-        ld = dld.d2l;
-    } else { // spot light
-        dld.d2l = glm::normalize(light.position - hit.p);
-        ERROR("Not implemented yet!");
+void Scene::gatherLight(VertexLight& light, Spectrum& radiance, std::vector<Spectrum>* aov) const {
+    // whatever of a vertex's sampled light nothing blocks, weighted by the volumes in between
+    if (light.stream.count > 0) {
+        uint32_t blocked = occluded(light.stream);
+        for (int i = 0; i < light.stream.count; i++) {
+            if ((blocked >> i) & 1u) continue;
+            Spectrum shaded = light.shaded[i];
+            if (light.attenuated) shaded = shaded * Volumes::transmittance(volumes, { light.stream.p + light.stream.d[i] * EPSILON, light.stream.d[i] }, light.stream.dist[i]);
+            deposit(radiance, shaded, light.bins, aov, light.sources[i]);
+        }
+        light.stream.count = 0;
     }
-    dld.diffuse = std::max(0.0f, glm::dot(hit.n, ld));
-    dld.specular = (dld.diffuse > 0)*std::pow(std::max(0.0f, glm::dot(glm::normalize(jlm::reflect(ld, hit.n)), hit.d2c)), mat.shiny());
-    return dld;
+    if (light.pending) {
+        float t = intersect(light.emitter).t;
+        if (t <= 0.0f || t >= light.limit) {
+            float transmitted = light.attenuated ? Volumes::transmittance(volumes, light.emitter, light.limit) : 1.0f;
+            deposit(radiance, light.emitted * transmitted, light.bins, aov, light.source);
+        }
+        light.pending = false;
+    }
+}
+
+Spectrum Scene::bidirectional(const Ray& ray, int x, int y, int index, SplatBuffer& splats) {
+    // both subpaths refract with one hero wavelength, so every connection between them is a path
+    // one of them could have traced on its own
+    Sampler& sampler = Sampler::get();
+    int wavelength = std::min((int)(sampler.get1D() * NMSAMPLES), NMSAMPLES - 1);
+    int depth = std::min(GlobalConfig::maxDepth(), BDPT_DEPTH);
+    PathVertex eye[BDPT_DEPTH + 2];
+    PathVertex light[BDPT_DEPTH + 1];
+    eye[0] = PathVertex{};
+    eye[0].type = CAMERA_VERTEX;
+    eye[0].p = ray.p;
+    eye[0].n = ray.d;
+    eye[0].beta = Spectrum(1.0f);
+    eye[0].lit = Spectrum(1.0f);
+    int t = walk(ray, (Medium){ 1.0f, 0, MaterialUtils::AirMaterial(), Spectrum(1.0f), wavelength, ray.p },
+        Spectrum(1.0f), camera.pdf(ray.d), eye, depth + 2);
+    sampler.start(BDPT_STREAM, y * camera.width + x, index);
+    int s = traceLightPath(wavelength, light, depth + 1);
+
+    // CONNECTIONS
+    // every split of every path length, light tracing (t = 1) lands on whichever pixel it hits.
+    // the light's own vertex seen straight from the camera is left to the camera subpath
+    Spectrum radiance = Spectrum(0.0f);
+    for (int ti = 1; ti <= t; ti++) {
+        for (int si = 0; si <= s; si++) {
+            int length = ti + si - 2;
+            if ((si == 1 && ti == 1) || length < 0 || length > depth) continue;
+            glm::vec2 raster;
+            Spectrum c = connect(light, si, eye, ti, raster);
+            if (c.black()) continue;
+            c = c * Bidirectional::weight(*this, light, si, eye, ti);
+            if (ti == 1) SplatUtils::splat(splats, raster, c.rgb());
+            else radiance += c;
+        }
+    }
+    return radiance;
+}
+
+int Scene::walk(Ray ray, Medium medium, Spectrum beta, float pdf, PathVertex* path, int count) {
+    // extends a subpath from path[0] until it escapes, is absorbed or fills count vertices.
+    // emitters end camera subpaths as light vertices and absorb light subpaths
+    bool eye = path[0].type == CAMERA_VERTEX;
+    bool fromLight = !eye && path[0].source >= 0;
+    bool landed = false;
+    bool isolated = false;
+    Spectrum lit = beta;
+    float start = beta.max();
+    if (!(start > 0.0f)) return 1;
+    int n = 1;
+    while (n < count) {
+        Hit hit = intersect(ray);
+        Hit h2 = intersect2(ray);
+        bool proxy = h2.t > 0.0f && (hit.t <= 0.0f || h2.t < hit.t);
+        if (proxy) hit = h2;
+        if (hit.t <= 0.0f || (!proxy && hit.material == materials.size() - 1)) break;
+        PathVertex& prev = path[n - 1];
+        PathVertex& v = path[n];
+        v = PathVertex{};
+        v.type = SURFACE_VERTEX;
+        v.p = hit.p;
+        v.n = hit.n;
+        v.beta = beta;
+        v.lit = lit;
+        v.isolated = isolated;
+        v.pdfFwd = Bidirectional::convert(pdf, prev, v);
+        Material* m = hit.material < 0 ? MaterialUtils::DefaultMaterial() : &(materials[hit.material]);
+        if (proxy || m->emissive()) {
+            if (!eye) break;
+            v.type = LIGHT_VERTEX;
+            v.source = proxy ? Bidirectional::light(*this, hit.p) : -1 - hit.material;
+            if (proxy) v.n = glm::normalize(hit.p - lPrimitive[Bidirectional::proxy(*this, v.source)].v1);
+            n++;
+            break;
+        }
+        v.material = m;
+        v.delta = m->type() != LAMBERTIAN;
+        n++;
+        if (n >= count) break;
+
+        // the density of this vertex scattering back towards the one before does not depend on
+        // where the subpath goes next, so it is known before the bounce is sampled
+        float rev = v.delta ? 0.0f : std::max(0.0f, glm::dot(hit.n, hit.d2c)) / M_PI;
+        prev.pdfRev = Bidirectional::convert(rev, v, prev);
+
+        // RUSSIAN ROULETTE
+        if (medium.bounces >= GlobalConfig::minDepth()) {
+            float q = CLAMP(beta.max() / start, 0.05f, 1.0f);
+            if (Sampler::get().get1D() > q) break;
+            beta /= q;
+            lit /= q;
+        }
+
+        SampleList samples = m->sample(hit, medium);
+        if (samples.empty() || samples[0].pdf <= 0.0f) break;
+        const Sample& sample = samples[0];
+        if (v.delta) {
+            bool volPass = m->type() == VOLUMETRIC;
+            Spectrum factor = volPass ? Spectrum(sample.transmission) : sample.color;
+            beta *= factor;
+            lit *= factor;
+            isolated = isolated || (m->type() == DIELECTRIC && m->diffract());
+            pdf = 0.0f;
+        } else {
+            float cosTheta = glm::dot(sample.incoming, hit.n);
+            if (cosTheta <= 0.0f) break;
+            if (eye) {
+                lit = beta * Bidirectional::reflectance(*m, cosTheta, true) * (cosTheta / sample.pdf);
+            } else if (fromLight && !landed) {
+                v.first = true;
+                landed = true;
+            }
+            beta *= Bidirectional::reflectance(*m, glm::dot(hit.n, hit.d2c), v.first) * (cosTheta / sample.pdf);
+            pdf = sample.pdf;
+        }
+        if (beta.black() && (!eye || lit.black())) break;
+        medium = (Medium){ sample.ior, medium.bounces + 1, m->type() == VOLUMETRIC ? medium.material : MaterialUtils::continued(m, medium, sample), Spectrum(1.0f), sample.wavelength, hit.p };
+        ray = (Ray){ hit.p + sample.incoming * EPSILON, sample.incoming };
+    }
+    return n;
+}
+
+int Scene::traceLightPath(int wavelength, PathVertex* path, int count) {
+    // a light subpath leaves the way a photon does, but carries the whole spectrum
+    if (photonSources.empty()) return 0;
+    Sampler& sampler = Sampler::get();
+    float u = sampler.get1D();
+    int s = std::min((int)(std::lower_bound(photonCDF.begin(), photonCDF.end(), u) - photonCDF.begin()), (int)photonSources.size() - 1);
+    const PhotonSource& source = photonSources[s];
+    PathVertex& v = path[0];
+    v = PathVertex{};
+    v.type = LIGHT_VERTEX;
+    if (source.light >= 0) {
+        // sphere lights leave from the proxy cameras see them as, so both ends agree on the surface
+        const Light& light = lights[source.light];
+        if (light.radius > 0.0f) {
+            EmitterSample es = SamplePrimitive(lPrimitive[Bidirectional::proxy(*this, source.light)], sampler.get2D());
+            v.p = es.p;
+            v.n = es.n;
+        } else {
+            LightSample ls = LightSampler::sampleArea(light, lightGeometry[source.light], sampler.get2D());
+            v.p = ls.p;
+            v.n = ls.n;
+        }
+        v.source = source.light;
+    } else {
+        EmitterSample es = SamplePrimitive(primitives[source.primitive], sampler.get2D());
+        v.p = es.p;
+        v.n = sampler.get1D() < 0.5f ? es.n : -es.n;
+        v.source = -1 - primitives[source.primitive].material;
+    }
+    v.pdfFwd = Bidirectional::origin(*this, v);
+    if (v.pdfFwd <= 0.0f) return 0;
+    v.beta = source.emission / v.pdfFwd;
+    v.lit = v.beta;
+    glm::vec3 d = glm::normalize(SampleUtils::onb(v.n, SampleUtils::hemisphereSample()));
+    float cosTheta = glm::dot(v.n, d);
+    float pdf = cosTheta / M_PI * (v.source >= 0 ? 1.0f : 0.5f);
+    if (pdf <= 0.0f) return 1;
+    return walk((Ray){ v.p + d * EPSILON, d }, (Medium){ 1.0f, 0, MaterialUtils::AirMaterial(), Spectrum(1.0f), wavelength, v.p },
+        v.beta * (cosTheta / pdf), pdf, path, count);
+}
+
+Spectrum Scene::connect(const PathVertex* light, int s, const PathVertex* eye, int t, glm::vec2& raster) const {
+    // unweighted contribution of the path made of the first s light and t camera vertices. a
+    // diffracting dielectric on either side leaves only the hero wavelength, which stands in for all
+    const PathVertex& pt = eye[t - 1];
+    float scale = pt.isolated || (s > 0 && light[s - 1].isolated) ? NMSAMPLES : 1.0f;
+    if (s == 0) {
+        if (pt.type != LIGHT_VERTEX) return Spectrum(0.0f);
+        glm::vec3 w = glm::normalize(eye[t - 2].p - pt.p);
+        return (pt.source >= 0 ? pt.lit : pt.beta) * Bidirectional::emission(*this, pt, w) * scale;
+    }
+    const PathVertex& qs = light[s - 1];
+    if (qs.delta) return Spectrum(0.0f);
+    if (t == 1) {
+        // LIGHT TRACING
+        float pdf;
+        if (!camera.project(qs.p, raster, pdf)) return Spectrum(0.0f);
+        glm::vec3 w = pt.p - qs.p;
+        float dist2 = glm::dot(w, w);
+        w /= std::sqrt(dist2);
+        float cosLight = glm::dot(qs.n, w);
+        if (cosLight <= 0.0f || !visible(qs.p, pt.p)) return Spectrum(0.0f);
+        float cosIn = glm::dot(qs.n, glm::normalize(light[s - 2].p - qs.p));
+        return qs.beta * Bidirectional::reflectance(*qs.material, cosIn, qs.first) * (cosLight * pdf / dist2 * scale);
+    }
+    if (pt.type != SURFACE_VERTEX || pt.delta) return Spectrum(0.0f);
+    glm::vec3 w = qs.p - pt.p;
+    float dist2 = glm::dot(w, w);
+    w /= std::sqrt(dist2);
+    float cosCamera = glm::dot(pt.n, w);
+    if (cosCamera <= 0.0f) return Spectrum(0.0f);
+    Spectrum c;
+    float cosLight;
+    if (s == 1) {
+        // the light's beta already holds its emission, lights only emit from their outer side
+        cosLight = std::abs(glm::dot(qs.n, w));
+        if (qs.source >= 0 && glm::dot(qs.n, w) >= 0.0f) return Spectrum(0.0f);
+        c = pt.beta * Bidirectional::reflectance(*pt.material, cosCamera, qs.source >= 0) * qs.beta;
+    } else {
+        cosLight = -glm::dot(qs.n, w);
+        if (cosLight <= 0.0f) return Spectrum(0.0f);
+        float cosIn = glm::dot(qs.n, glm::normalize(light[s - 2].p - qs.p));
+        c = qs.beta * Bidirectional::reflectance(*qs.material, cosIn, qs.first)
+            * Bidirectional::reflectance(*pt.material, cosCamera, false) * pt.beta;
+    }
+    if (c.black() || !visible(pt.p, qs.p)) return Spectrum(0.0f);
+    return c * (cosCamera * cosLight / dist2 * scale);
+}
+
+bool Scene::visible(const glm::vec3& p, const glm::vec3& q) const {
+    // sphere lights block connections as they block subpaths
+    glm::vec3 direction = q - p;
+    float dist = glm::length(direction);
+    glm::vec3 dirNorm = direction / dist;
+    Ray ray = { p + dirNorm * EPSILON, dirNorm };
+    float limit = dist * (1.0f - EPSILON) - EPSILON;
+    float t = intersect(ray).t;
+    if (t > 0.0f && t < limit) return false;
+    t = intersect2(ray).t;
+    return t <= 0.0f || t >= limit;
+}
+
+void Scene::tracePaths(WavefrontBuffer& buffer, size_t start, size_t count) {
+    // the intersect stage, which also sorts each vertex into the kind of work it needs
+    for (size_t k = start; k < start + count; k++) {
+        uint32_t i = buffer.active[k];
+        const Ray& ray = buffer.rays[i];
+        Hit hit = intersect(ray);
+        if (buffer.depths[i] == 0) {
+            Hit h1 = intersect2(ray);
+            if (h1.t > 0.0 && (h1.t < hit.t || hit.t <= 0.0f)) hit = h1;
+        }
+        buffer.hits[i] = hit;
+        if (hit.t <= 0.0f) {
+            buffer.kinds[i] = WAVEFRONT_MISS;
+            continue;
+        }
+        const Material* m = hit.material < 0 ? MaterialUtils::DefaultMaterial() : &(materials[hit.material]);
+        if (m->emissive()) buffer.kinds[i] = WAVEFRONT_EMISSIVE;
+        else if (m->type() == LAMBERTIAN) buffer.kinds[i] = WAVEFRONT_LAMBERTIAN;
+        else if (m->type() == DIELECTRIC) buffer.kinds[i] = WAVEFRONT_DIELECTRIC;
+        else buffer.kinds[i] = WAVEFRONT_VOLUMETRIC;
+    }
+}
+
+void Scene::shadePaths(WavefrontBuffer& buffer, size_t start, size_t count, ShadowQueue& shadows) {
+    // the shade stage, over a share of the sorted paths. each path takes up its own sample
+    // sequence where the last stage left it, and the light its vertex sampled joins the queue
+    Sampler& sampler = Sampler::get();
+    VertexLight light;
+    for (size_t k = start; k < start + count; k++) {
+        uint32_t i = buffer.order[k];
+        sampler.restore(buffer.states[i]);
+        // the kernel compiled for what the scene holds, as pathColor picks it
+        switch (features) {
+            case 0: buffer.alive[i] = shadePath<0>(buffer, i, light); break;
+            case 1: buffer.alive[i] = shadePath<1>(buffer, i, light); break;
+            case 2: buffer.alive[i] = shadePath<2>(buffer, i, light); break;
+            case 3: buffer.alive[i] = shadePath<3>(buffer, i, light); break;
+            case 4: buffer.alive[i] = shadePath<4>(buffer, i, light); break;
+            case 5: buffer.alive[i] = shadePath<5>(buffer, i, light); break;
+            case 6: buffer.alive[i] = shadePath<6>(buffer, i, light); break;
+            default: buffer.alive[i] = shadePath<FEATURE_ALL>(buffer, i, light); break;
+        }
+        buffer.states[i] = sampler.save();
+        WavefrontUtils::queue(shadows, i, light);
+    }
+}
+
+template <int Features>
+bool Scene::shadePath(WavefrontBuffer& buffer, uint32_t i, VertexLight& light) {
+    // one vertex of pathKernel through the same shadeVertex, less the photons, the guide, the cache
+    // and the reservoirs. the light it samples waits for the shadow stage. a diffracting dielectric
+    // continues along one of its wavelengths picked at random instead of branching into all of
+    // them. false once the path ends
+    PathState path;
+    path.ray = buffer.rays[i];
+    path.medium = buffer.media[i];
+    path.depth = buffer.depths[i];
+    path.roulette = buffer.roulette[i];
+    path.specular = buffer.specular[i];
+    path.diffuse = buffer.diffuse[i];
+    path.pdf = buffer.pdfs[i];
+    int* pathBins = &buffer.bins[i * NMSAMPLES];
+    for (int j = 0; j < NMSAMPLES; j++) path.bins[j] = pathBins[j];
+    PathContext context = { GlobalConfig::minDepth(), GlobalConfig::maxDepth(),
+        (Features & FEATURE_EMITTERS) && GlobalConfig::emitterSampling() && emitters.size() > 0,
+        nullptr, nullptr, nullptr, nullptr, 0, nullptr, 0 };
+
+    PathState next[NMSAMPLES];
+    int branches = shadeVertex<Features>(path, buffer.hits[i], context, light, true, buffer.radiance[i], next);
+    if (branches == 0) return false;
+    // a slot holds one path, so where pathKernel follows every wavelength a diffracting dielectric
+    // splits into, one is followed here, weighted by how many there were. the same expectation,
+    // only noisier in colour
+    PathState& chosen = next[branches > 1 ? std::min((int)(jlm::random01() * branches), branches - 1) : 0];
+    if (branches > 1) chosen.medium.throughput *= (float)branches;
+
+    // RUSSIAN ROULETTE
+    // drawn for the next vertex now, where pathKernel draws it before tracing that vertex
+    if (chosen.roulette) {
+        float p = CLAMP(chosen.medium.throughput.max(), 0.05f, 1.0f);
+        if (Sampler::get().get1D() > p) return false;
+        chosen.medium.throughput /= p;
+    }
+    buffer.rays[i] = chosen.ray;
+    buffer.media[i] = chosen.medium;
+    buffer.depths[i] = chosen.depth;
+    buffer.roulette[i] = chosen.roulette;
+    buffer.specular[i] = chosen.specular;
+    buffer.diffuse[i] = chosen.diffuse;
+    buffer.pdfs[i] = chosen.pdf;
+    for (int j = 0; j < NMSAMPLES; j++) pathBins[j] = chosen.bins[j];
+    return true;
+}
+
+void Scene::testShadows(WavefrontBuffer& buffer, ShadowQueue& shadows) {
+    // the shadow stage, over the queue the same worker's share of the shade stage filled. each
+    // vertex's rays are gathered back into one stream and tested as pathKernel tests them
+    VertexLight light;
+    uint32_t first = 0;
+    for (size_t v = 0; v < shadows.paths.size(); v++) {
+        light.stream.p = shadows.origins[v];
+        for (uint32_t r = first; r < shadows.ends[v]; r++) {
+            light.shaded[light.stream.count] = shadows.shaded[r];
+            streamShadow(light.stream, shadows.directions[r], shadows.distances[r]);
+        }
+        first = shadows.ends[v];
+        int e = shadows.emitters[v];
+        if (e >= 0) {
+            light.emitter = shadows.rays[e];
+            light.limit = shadows.limits[e];
+            light.emitted = shadows.emitted[e];
+            light.pending = true;
+        }
+        light.attenuated = shadows.attenuated[v];
+        for (int j = 0; j < NMSAMPLES; j++) light.bins[j] = shadows.bins[v * NMSAMPLES + j];
+        gatherLight(light, buffer.radiance[shadows.paths[v]], nullptr);
+    }
+    WavefrontUtils::clear(shadows);
+}
+
+DirectLightData SceneUtils::directLight(const Light& light, const Hit& hit, const Material& mat) {
+    return DirectLightAt(light, light.position, hit, mat);
 }
@@ -4,6 +4,13 @@
 #include "scene/camera.h"
 #include "scene/hit.h"
 #include "scene/bvh.h"
+#include "scene/lighttree.h"
+#include "scene/lightsampler.h"
+#include "scene/guiding.h"
+#include "scene/photons.h"
+#include "scene/cache.h"
+#include "scene/bdpt.h"
+#include "scene/volume.h"
 #include "scene/spectrum.h"
 #include "scene/material.h"
 #include "scene/fourier.h"
@@ -11,7 +18,7 @@
 #include <glm/glm.hpp>
 #include <string>
 #include <unordered_map>
-#include <random>
+#include <limits>
 
 typedef glm::vec3 vertex;
 typedef glm::vec3 nongeo;
@@ -42,7 +49,88 @@ struct Medium {
 	Spectrum throughput;
 	int wavelength;
 	glm::vec3 previous;
-	float depth;
+	float depth = 0.0f;
+};
+
+struct PathState {
+    Ray ray;
+    Medium medium;
+    int depth;
+    bool roulette;
+    bool specular; // last bounce was a delta event (or the camera), so emission is not MIS weighted
+    bool diffuse;  // a diffuse bounce came before, light reaching it through specular events is left to photons
+    float pdf;     // solid angle pdf of the last bounce
+    int bins[NMSAMPLES] = {};
+};
+
+// a pending branch of a raytrace mode ray tree. weight and bins stand for every split, absorption
+// and conversion between the branch and the pixel, so its light goes straight into the pixel
+struct RayBranch {
+    Ray ray;
+    Medium medium;
+    int depth;
+    Spectrum weight;
+    int bins[NMSAMPLES] = {};
+};
+
+#define SHADOW_STREAM 32 // most shadow rays traced together, one bit each in the masks
+
+// shadow rays from one shading point towards light samples, traced through the BVH together.
+// traversal tests a node's box against every ray still active from the shared origin, and rays
+// drop out as soon as anything blocks them
+struct ShadowStream {
+    glm::vec3 p;
+    glm::vec3 d[SHADOW_STREAM];
+    glm::vec3 dfrac[SHADOW_STREAM];
+    float dist[SHADOW_STREAM]; // to the light sample
+    int count = 0;
+};
+
+// the direct light one vertex sampled, waiting on its shadow rays. the path kernel traces them as
+// soon as they are picked, the wavefront leaves them to its shadow stage
+struct VertexLight {
+    ShadowStream stream;            // towards the light samples
+    Spectrum shaded[SHADOW_STREAM]; // what each light sample adds if nothing blocks it
+    int sources[SHADOW_STREAM];     // the light each came from
+    Ray emitter;                    // towards the emitter sample, when pending
+    float limit = 0.0f;             // anything hit closer than this blocks the emitter sample
+    Spectrum emitted;
+    int source = 0;
+    bool pending = false;
+    bool attenuated = false;        // shadow rays are weighted by the volumes they pass through
+    int bins[NMSAMPLES] = {};
+};
+
+// what a scene holds that the path kernel has to handle. prepareKernels() works it out once the
+// scene has loaded, so paths run a kernel compiled without the branches for anything it lacks
+enum SceneFeature {
+    FEATURE_EMITTERS = 1 << 0,    // emissive geometry, sampled directly
+    FEATURE_VOLUMES = 1 << 1,
+    FEATURE_DIFFRACTION = 1 << 2, // dielectrics that split paths by wavelength
+    FEATURE_ALL = (1 << 3) - 1
+};
+
+struct SplatBuffer;
+struct WavefrontBuffer;
+struct ShadowQueue;
+struct PathContext;
+
+struct EmitterSample {
+    glm::vec3 p;
+    glm::vec3 n;
+    int material;
+};
+
+// a light sample picked by resampling, kept as a point so neighbours and later frames can reuse it
+struct Reservoir {
+    int light = -1;
+    glm::vec3 p;
+    glm::vec3 n;
+    float wsum = 0.0f;
+    float M = 0.0f;
+    float W = 0.0f; // estimate of 1 / pdf of the chosen point, per unit area
+    glm::vec3 origin = glm::vec3(std::numeric_limits<float>::max()); // the g-buffer point W was made for
+    glm::vec3 normal = glm::vec3(0.0f);
 };
 
 struct Scene {
@@ -58,19 +146,60 @@ struct Scene {
     std::vector<NodeBVH> bvh2;
 	std::vector<Material> materials;
 	std::unordered_map<std::string, int> matmap;
-    std::mt19937 gen;
-    std::uniform_real_distribution<> dis;
-    Spectrum shade(int x, int y);
-    Spectrum shade(const Ray& ray, const Medium& medium, int recur);
+	std::vector<int> aovmap;
+	std::vector<int> emitters;
+	std::vector<float> emitterCDF;
+	float emitterArea = 0.0f;
+	std::vector<LightNode> lightTree;
+	std::vector<LightGeometry> lightGeometry;
+	Guide guide;
+	std::vector<PhotonSource> photonSources;
+	std::vector<float> photonCDF;
+	std::vector<PhotonMap> photonMaps;
+	float photonFlux = 0.0f; // summed over photonSources
+	RadianceCache cache;
+	std::vector<DensityGrid> volumes;
+	int features = FEATURE_ALL;
+	PrimitiveMix mix = MIXED_PRIMITIVES;  // of primitives
+	PrimitiveMix mix2 = MIXED_PRIMITIVES; // of lPrimitive
+    Spectrum shade(int x, int y, std::vector<Spectrum>* aov = nullptr, int* spent = nullptr, const Reservoir* reservoir = nullptr, SplatBuffer* splats = nullptr);
+	Spectrum train(int x, int y, int pass, std::vector<GuideRecord>& records);
+	void warm(int x, int y, int pass, std::vector<CacheRecord>& records);
+	Spectrum preview(int x, int y);
+	Spectrum shadeRaster(glm::vec2& raster, int pass);
+    Spectrum rayTree(const Ray& ray, const Medium& medium);
 	void pollMetadata(const Ray& ray, glm::vec3& n, glm::vec3& p, glm::vec3& a) const;
+	bool occluded(const glm::vec3& p, const glm::vec3& q) const;
+	uint32_t occluded(const ShadowStream& stream) const; // bit i set when ray i is blocked
+	void prepareAOVs();
+	void prepareEmitters();
+	void prepareKernels();
+	void prepareVolumes();
+	void preparePhotons();
+	void tracePhoton(uint32_t pass, uint32_t index, std::vector<Photon>& photons);
+	void tracePaths(WavefrontBuffer& buffer, size_t start, size_t count);
+	void shadePaths(WavefrontBuffer& buffer, size_t start, size_t count, ShadowQueue& shadows);
+	void testShadows(WavefrontBuffer& buffer, ShadowQueue& shadows);
+	int aovCount() const;
+	std::string aovName(int channel) const;
 private:
     Hit intersect(const Ray& ray) const;
     Hit intersect2(const Ray& ray) const;
-    Hit traverse(const Ray& ray, size_t ind) const;
-    Hit traverse2(const Ray& ray, size_t ind) const;
-    Spectrum rayColor(const Hit& hit, const Medium& medium, int recur);
-	Spectrum pathColor(const Hit& hit, const Medium& medium, int recur);
-    bool sampleAreaLight(const Light& light, const Hit& hit);
+    template <PrimitiveMix Mix> Hit traverse(const Ray& ray, const glm::vec3& dfrac, size_t ind) const;
+    template <PrimitiveMix Mix> Hit traverse2(const Ray& ray, const glm::vec3& dfrac, size_t ind) const;
+    template <PrimitiveMix Mix> uint32_t traverseShadows(const ShadowStream& stream, uint32_t active, size_t ind) const;
+    EmitterSample sampleEmitter(float u1, glm::vec2 u2) const;
+    void rayColor(const Hit& hit, const RayBranch& branch, std::vector<RayBranch>& tree, Spectrum& radiance);
+	Spectrum pathColor(const Ray& ray, std::vector<Spectrum>* aov, const Reservoir* reservoir, const PhotonMap* photons, std::vector<GuideRecord>* records = nullptr, std::vector<CacheRecord>* cached = nullptr);
+	template <int Features> Spectrum pathKernel(const Ray& ray, std::vector<Spectrum>* aov, const Reservoir* reservoir, const PhotonMap* photons, std::vector<GuideRecord>* records, std::vector<CacheRecord>* cached);
+	template <int Features> int shadeVertex(const PathState& path, const Hit& hit, PathContext& context, VertexLight& light, bool defer, Spectrum& radiance, PathState* next);
+	void gatherLight(VertexLight& light, Spectrum& radiance, std::vector<Spectrum>* aov) const;
+	Spectrum bidirectional(const Ray& ray, int x, int y, int index, SplatBuffer& splats);
+	int walk(Ray ray, Medium medium, Spectrum beta, float pdf, PathVertex* path, int count);
+	int traceLightPath(int wavelength, PathVertex* path, int count);
+	Spectrum connect(const PathVertex* light, int s, const PathVertex* eye, int t, glm::vec2& raster) const;
+	bool visible(const glm::vec3& p, const glm::vec3& q) const;
+	template <int Features> bool shadePath(WavefrontBuffer& buffer, uint32_t path, VertexLight& light);
 };
 
 namespace SceneUtils {
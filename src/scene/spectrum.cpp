@@ -18,7 +18,7 @@ Spectrum::Spectrum(std::vector<float> lambdas, std::vector<float> values) {
     }
 }
 
-Spectrum::Spectrum(Fourier f) {
+Spectrum::Spectrum(const Fourier& f) {
     set(0.0f);
     for (int i = 0; i < NMSAMPLES; i++)
         m_samples[i] = f.evaluate(wavelength(i));
@@ -28,7 +28,7 @@ int Spectrum::bin(float wavelength) {
     return CLAMP(((wavelength - NMSTART)/NMSAMPLESIZE), 0.0f, NMSAMPLES - 1.0f);
 }
 
-void Spectrum::translate(Fourier f) {
+void Spectrum::translate(const Fourier& f) {
     float oldsamples[NMSAMPLES];
     for (int i = 0; i < NMSAMPLES; i++)
         oldsamples[i] = m_samples[i];
@@ -190,6 +190,10 @@ float& Spectrum::operator[](int i) {
     return m_samples[i];
 }
 
+float Spectrum::operator[](int i) const {
+    return m_samples[i];
+}
+
 Spectrum Spectrum::isolate(const Spectrum& s, int wavelength) {
 	Spectrum ret = Spectrum(0.0f);
 	ret[wavelength] = s.m_samples[wavelength];
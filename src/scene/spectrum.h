@@ -15,10 +15,10 @@ class Spectrum {
 public:
     Spectrum(float v = 0.0f);
     Spectrum(std::vector<float> lambdas, std::vector<float> values);
-    Spectrum(Fourier f);
+    Spectrum(const Fourier& f);
 public:
-    int bin(float wavelength);
-    void translate(Fourier f);
+    static int bin(float wavelength);
+    void translate(const Fourier& f);
     void set(float value);
     bool black();
     float average(float start, float end);
@@ -47,6 +47,7 @@ public:
     Spectrum operator*(float f) const;
     Spectrum operator/(float f) const;
     float& operator[](int i);
+    float operator[](int i) const;
 public:
 	static Spectrum isolate(const Spectrum& s, int wavelength);
     static Spectrum sqrt(const Spectrum& s);
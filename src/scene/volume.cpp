@@ -0,0 +1,202 @@
+#include "volume.h"
+#include "util/jlm.h"
+#include "util/noise.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#define VOLUME_ROULETTE 0.1f // transmittance below which ratio tracking plays russian roulette
+
+template <typename Visit>
+bool Walk(const DensityGrid& grid, const Ray& ray, float limit, Visit visit) {
+    // every brick the ray crosses before limit, in order, calling visit(enter, exit, majorant) on the
+    // ones that are not empty until it returns true
+    if (grid.density.empty()) return false;
+    glm::vec3 inverse;
+    for (int a = 0; a < 3; a++) inverse[a] = ray.d[a] != 0.0f ? 1.0f / ray.d[a] : 1e30f;
+    glm::vec3 t1 = (grid.min - ray.p) * inverse;
+    glm::vec3 t2 = (grid.min + glm::vec3(grid.cells) * grid.cell - ray.p) * inverse;
+    glm::vec3 near = glm::min(t1, t2);
+    glm::vec3 far = glm::max(t1, t2);
+    float t = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+    float end = std::min(std::min(far.x, far.y), std::min(far.z, limit));
+    if (!(t < end)) return false;
+
+    float brick = grid.cell * VOLUME_BRICK;
+    glm::ivec3 b = glm::clamp(glm::ivec3(glm::floor((ray.p + ray.d * t - grid.min) / brick)), glm::ivec3(0), grid.bricks - 1);
+    glm::ivec3 step;
+    glm::vec3 next;
+    glm::vec3 delta;
+    for (int a = 0; a < 3; a++) {
+        step[a] = ray.d[a] >= 0.0f ? 1 : -1;
+        next[a] = (grid.min[a] + (b[a] + (step[a] > 0 ? 1 : 0)) * brick - ray.p[a]) * inverse[a];
+        delta[a] = brick * std::abs(inverse[a]);
+    }
+    while (t < end) {
+        int a = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+        float exit = std::min(next[a], end);
+        float majorant = grid.majorants[b.x + grid.bricks.x * (b.y + grid.bricks.y * b.z)];
+        if (majorant > 0.0f && exit > t && visit(t, exit, majorant)) return true;
+        t = std::max(t, exit);
+        b[a] += step[a];
+        if (b[a] < 0 || b[a] >= grid.bricks[a]) break;
+        next[a] += delta[a];
+    }
+    return false;
+}
+
+DensityGrid Volumes::bake(const std::vector<Primitive>& primitives, int material) {
+    DensityGrid grid{};
+    grid.material = material;
+    std::vector<const Primitive*> boundary;
+    glm::vec3 lo = glm::vec3(FLT_MAX);
+    glm::vec3 hi = glm::vec3(-FLT_MAX);
+    for (const Primitive& p : primitives) {
+        if (p.material != material) continue;
+        AABB bb = PrimitiveUtils::generateAABB(p);
+        lo = glm::min(lo, bb.min);
+        hi = glm::max(hi, bb.max);
+        boundary.push_back(&p);
+    }
+    if (boundary.empty()) return grid;
+    glm::vec3 extent = hi - lo;
+    grid.min = lo;
+    grid.cell = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) / VOLUME_RESOLUTION;
+    grid.cells = glm::max(glm::ivec3(glm::ceil(extent / grid.cell)), glm::ivec3(1));
+    grid.bricks = (grid.cells + (VOLUME_BRICK - 1)) / VOLUME_BRICK;
+    glm::ivec3 corners = grid.cells + 1;
+    grid.density.assign((size_t)corners.x * corners.y * corners.z, 0.0f);
+
+    // DENSITY
+    // the boundary is closed, so a corner is inside once an odd number of crossings lie before it
+    // along its row. the noise is remapped as the ray march remapped it, without the negative
+    // densities that gave between 0.22 and 0.5
+    std::vector<float> crossings;
+    std::vector<int> inside;
+    std::vector<glm::vec3> points;
+    std::vector<float> noise;
+    for (int k = 0; k < corners.z; k++) {
+        for (int j = 0; j < corners.y; j++) {
+            glm::vec3 origin = grid.min + glm::vec3(-grid.cell, j * grid.cell, k * grid.cell);
+            crossings.clear();
+            for (const Primitive* p : boundary) {
+                // a sphere is crossed at most twice and a triangle once
+                float t = 0.0f;
+                for (int c = 0; c < 2; c++) {
+                    Hit h = PrimitiveUtils::intersect({ origin + glm::vec3(t, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f) }, *p);
+                    if (h.t <= 0.0f) break;
+                    t += h.t;
+                    crossings.push_back(t);
+                    t += 1e-4f * grid.cell;
+                }
+            }
+            std::sort(crossings.begin(), crossings.end());
+            size_t c = 0;
+            inside.clear();
+            points.clear();
+            for (int i = 0; i < corners.x; i++) {
+                while (c < crossings.size() && crossings[c] < (i + 1) * grid.cell) c++;
+                if (c % 2 == 0) continue;
+                inside.push_back(i);
+                points.push_back(grid.min + glm::vec3(i, j, k) * grid.cell);
+            }
+            // the whole row's noise in one batch
+            noise.resize(points.size());
+            Noise::get().applyPerlinWorley(points.data(), noise.data(), (int)points.size());
+            for (size_t i = 0; i < inside.size(); i++) {
+                grid.density[inside[i] + corners.x * ((size_t)j + corners.y * k)] = VOLUME_DENSITY * std::max(0.0f, 2.0f * noise[i] - 1.0f);
+            }
+        }
+    }
+
+    // MAJORANTS
+    // interpolation never leaves the range of the corners it blends, so a brick's largest corner
+    // bounds the density anywhere inside it
+    grid.majorants.assign((size_t)grid.bricks.x * grid.bricks.y * grid.bricks.z, 0.0f);
+    for (int k = 0; k < corners.z; k++) {
+        for (int j = 0; j < corners.y; j++) {
+            for (int i = 0; i < corners.x; i++) {
+                float d = grid.density[i + corners.x * ((size_t)j + corners.y * k)];
+                if (d <= 0.0f) continue;
+                // corners on a brick's face bound the bricks on both sides of it
+                for (int bz = std::max(0, (k - 1) / VOLUME_BRICK); bz <= std::min(grid.bricks.z - 1, k / VOLUME_BRICK); bz++)
+                    for (int by = std::max(0, (j - 1) / VOLUME_BRICK); by <= std::min(grid.bricks.y - 1, j / VOLUME_BRICK); by++)
+                        for (int bx = std::max(0, (i - 1) / VOLUME_BRICK); bx <= std::min(grid.bricks.x - 1, i / VOLUME_BRICK); bx++) {
+                            float& m = grid.majorants[bx + grid.bricks.x * ((size_t)by + grid.bricks.y * bz)];
+                            m = std::max(m, d);
+                        }
+            }
+        }
+    }
+    return grid;
+}
+
+float Volumes::density(const DensityGrid& grid, const glm::vec3& p) {
+    // trilinear between the corners of the cell p is in
+    glm::vec3 local = (p - grid.min) / grid.cell;
+    if (glm::any(glm::lessThan(local, glm::vec3(0.0f))) || glm::any(glm::greaterThan(local, glm::vec3(grid.cells)))) return 0.0f;
+    glm::ivec3 c = glm::min(glm::ivec3(local), grid.cells - 1);
+    glm::vec3 f = local - glm::vec3(c);
+    size_t sx = 1;
+    size_t sy = grid.cells.x + 1;
+    size_t sz = sy * (grid.cells.y + 1);
+    const float* d = &grid.density[c.x * sx + c.y * sy + c.z * sz];
+    float x00 = d[0] + (d[sx] - d[0]) * f.x;
+    float x10 = d[sy] + (d[sy + sx] - d[sy]) * f.x;
+    float x01 = d[sz] + (d[sz + sx] - d[sz]) * f.x;
+    float x11 = d[sz + sy] + (d[sz + sy + sx] - d[sz + sy]) * f.x;
+    float y0 = x00 + (x10 - x00) * f.y;
+    float y1 = x01 + (x11 - x01) * f.y;
+    return y0 + (y1 - y0) * f.z;
+}
+
+bool Volumes::track(const std::vector<DensityGrid>& volumes, const Ray& ray, float limit, float& t, int& volume) {
+    // within a brick, tentative collisions come at the brick's majorant and are real ones in
+    // proportion to the density there. a later volume is only tracked up to the nearest
+    // collision so far, which samples the first collision of their summed densities
+    volume = -1;
+    for (int v = 0; v < volumes.size(); v++) {
+        const DensityGrid& grid = volumes[v];
+        float found = 0.0f;
+        bool collided = Walk(grid, ray, limit, [&](float enter, float exit, float majorant) {
+            float s = enter;
+            while (true) {
+                s -= std::log(1.0f - jlm::random01()) / majorant;
+                if (s >= exit) return false;
+                if (jlm::random01() * majorant < density(grid, ray.p + ray.d * s)) {
+                    found = s;
+                    return true;
+                }
+            }
+        });
+        if (!collided) continue;
+        limit = found;
+        t = found;
+        volume = v;
+    }
+    return volume >= 0;
+}
+
+float Volumes::transmittance(const std::vector<DensityGrid>& volumes, const Ray& ray, float limit) {
+    // every tentative collision keeps the chance it was not a real one
+    float transmitted = 1.0f;
+    for (const DensityGrid& grid : volumes) {
+        Walk(grid, ray, limit, [&](float enter, float exit, float majorant) {
+            float s = enter;
+            while (true) {
+                s -= std::log(1.0f - jlm::random01()) / majorant;
+                if (s >= exit) return false;
+                transmitted *= 1.0f - density(grid, ray.p + ray.d * s) / majorant;
+                if (transmitted < VOLUME_ROULETTE) {
+                    if (jlm::random01() * VOLUME_ROULETTE >= transmitted) {
+                        transmitted = 0.0f;
+                        return true;
+                    }
+                    transmitted = VOLUME_ROULETTE;
+                }
+            }
+        });
+        if (transmitted <= 0.0f) return 0.0f;
+    }
+    return transmitted;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "scene/primitives.h"
+#include "scene/ray.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#define VOLUME_RESOLUTION 128  // cells along the longest side of a volume's bounds
+#define VOLUME_BRICK 8         // cells along each side of a brick
+#define VOLUME_DENSITY 1.25f   // extinction per unit length where the noise is densest
+#define VOLUME_ANISOTROPY 0.3f // henyey greenstein asymmetry, forward scattering like fog
+
+// a volumetric material's density, baked when the scene is prepared onto a grid over the bounds
+// of its primitives and zero outside them, so the primitives themselves are no longer traced.
+// every brick keeps the largest density it holds, tracking takes steps sized to the brick it is
+// in and walks straight past the empty ones
+struct DensityGrid {
+    glm::vec3 min;
+    float cell = 0.0f;   // width of a cell
+    glm::ivec3 cells;
+    glm::ivec3 bricks;
+    std::vector<float> density;   // at every cell corner, cells + 1 per axis
+    std::vector<float> majorants; // per brick
+    int material = -1;
+};
+
+namespace Volumes {
+    DensityGrid bake(const std::vector<Primitive>& primitives, int material);
+    float density(const DensityGrid& grid, const glm::vec3& p);
+    // delta tracking, the distance along the ray of the first collision before limit, if any
+    bool track(const std::vector<DensityGrid>& volumes, const Ray& ray, float limit, float& t, int& volume);
+    // ratio tracking, an unbiased estimate of the transmittance up to limit
+    float transmittance(const std::vector<DensityGrid>& volumes, const Ray& ray, float limit);
+};
@@ -0,0 +1,3 @@
+#include "fastmath.h"
+
+bool FastMath::enabled = false;
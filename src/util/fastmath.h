@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// polynomial stand ins for the transcendentals the integrators call per bounce. every function is
+// branch free, so loops over them vectorise. errors below are the maximum measured over the range
+// each one is documented for
+
+namespace FastMath {
+	// latched from the config once per render, so the hot paths test a flag rather than call out
+	extern bool enabled;
+
+	inline float asFloat(int32_t i) {
+		float f;
+		std::memcpy(&f, &i, sizeof(f));
+		return f;
+	}
+
+	inline int32_t asInt(float f) {
+		int32_t i;
+		std::memcpy(&i, &f, sizeof(i));
+		return i;
+	}
+
+	// round down, for |x| < 2^31
+	inline float floor(float x) {
+		int32_t i = (int32_t)x;
+		return (float)(i - ((float)i > x));
+	}
+
+	// 2^x, relative error below 3e-7 on [-126, 128), clamped outside it
+	inline float exp2(float x) {
+		x = std::min(std::max(x, -126.0f), 127.99999f);
+		float i = floor(x);
+		float f = x - i;
+		float p = 1.8775767e-3f;
+		p = p * f + 8.9893397e-3f;
+		p = p * f + 5.5826318e-2f;
+		p = p * f + 2.4015361e-1f;
+		p = p * f + 6.9315308e-1f;
+		p = p * f + 9.9999994e-1f;
+		return p * asFloat(((int32_t)i + 127) << 23);
+	}
+
+	// e^x, relative error below 3e-7 + 7e-8 |x| wherever the result is a normal float
+	inline float exp(float x) {
+		return exp2(x * 1.44269504f);
+	}
+
+	// log2 of a positive normal float, absolute error below 4e-7 + 6e-8 |log2 x|
+	inline float log2(float x) {
+		// mantissa into [sqrt(1/2), sqrt(2)), where the atanh series converges fastest
+		int32_t bits = asInt(x);
+		float e = (float)(((bits >> 23) & 0xff) - 127);
+		float m = asFloat((bits & 0x007fffff) | 0x3f800000);
+		float high = m > 1.41421356f;
+		m *= 1.0f - 0.5f * high;
+		e += high;
+		float t = (m - 1.0f) / (m + 1.0f);
+		float t2 = t * t;
+		float p = 2.0f / 7.0f;
+		p = p * t2 + 2.0f / 5.0f;
+		p = p * t2 + 2.0f / 3.0f;
+		p = p * t2 + 2.0f;
+		return p * t * 1.44269504f + e;
+	}
+
+	// x^y for x >= 0, relative error below 3e-7 + 2e-7 |y| + 1e-7 |y log2 x|. 0^y is 0, 0^0 is 1
+	inline float pow(float x, float y) {
+		return x > 0.0f ? exp2(y * log2(x)) : (float)(y == 0.0f);
+	}
+
+	// odd polynomial for sin, on [-pi/2, pi/2]
+	inline float sinHalf(float x) {
+		float x2 = x * x;
+		float p = -2.5052108e-8f;
+		p = p * x2 + 2.7557319e-6f;
+		p = p * x2 - 1.9841270e-4f;
+		p = p * x2 + 8.3333333e-3f;
+		p = p * x2 - 1.6666667e-1f;
+		return x + x * x2 * p;
+	}
+
+	// sine and cosine together, absolute error below 3e-7 on [-1024, 1024]
+	inline void sincos(float x, float& s, float& c) {
+		// down to [-pi, pi], then mirrored into [-pi/2, pi/2]. cos(x) is sin(x + pi/2)
+		float k = floor(x * 0.159154943f + 0.5f);
+		x = (x - k * 6.28125f) - k * 1.93530717e-3f;
+		float y = x + 1.57079633f;
+		y -= 6.28318531f * (float)(y > 3.14159265f);
+		x = std::max(std::min(x, 3.14159265f - x), -3.14159265f - x);
+		y = std::max(std::min(y, 3.14159265f - y), -3.14159265f - y);
+		s = sinHalf(x);
+		c = sinHalf(y);
+	}
+
+	inline float sin(float x) {
+		float s, c;
+		sincos(x, s, c);
+		return s;
+	}
+
+	inline float cos(float x) {
+		float s, c;
+		sincos(x, s, c);
+		return c;
+	}
+};
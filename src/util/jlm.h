@@ -1,7 +1,9 @@
 #pragma once
 
 #include "glm/glm.hpp"
-#include <random>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 
 #define MAT4(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) glm::mat4(a,e,i,m,b,f,j,n,c,g,k,o,d,h,l,p)
 #define CLAMP(x, low, high) (std::max((low), std::min((high), x)))
@@ -9,10 +11,36 @@
 // not allowed to use certain  handy dandy glm functions? no problem! jlm (jason glm) is here!
 
 namespace jlm {
+	// pcg32 stream, one per thread. seeded from the pixel and sample number so results never
+	// depend on which thread rendered what
+	struct PCG32 {
+		uint64_t state = 0x853c49e6748fea9bULL;
+		uint64_t inc = 0xda3e39cb94b95bdbULL;
+		inline uint32_t next() {
+			uint64_t old = state;
+			state = old * 6364136223846793005ULL + inc;
+			uint32_t shifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+			uint32_t rot = (uint32_t)(old >> 59u);
+			return (shifted >> rot) | (shifted << ((-rot) & 31));
+		}
+	};
+
+	inline PCG32& rng() {
+		static thread_local PCG32 instance;
+		return instance;
+	}
+
+	inline void seed(uint64_t stream, uint64_t sample) {
+		PCG32& r = rng();
+		r.state = 0u;
+		r.inc = (stream << 1u) | 1u;
+		r.next();
+		r.state += sample * 0x9e3779b97f4a7c15ULL;
+		r.next();
+	}
+
 	inline float random01() {
-		static std::mt19937 rng(std::random_device{}());
-		static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-		return dist(rng);
+		return (rng().next() >> 8) * (1.0f / 16777216.0f);
 	}
 
     inline float clamp(float x, float min, float max) {
@@ -1,7 +1,10 @@
 #include "noise.h"
+#include "util/fastmath.h"
 #include <glm/glm.hpp>
+#include <algorithm>
 
-Noise::Noise() {}
+#define PERLIN_SIDE (PERLIN_PERIOD + 2)
+#define WORLEY_SIDE (WORLEY_PERIOD + 2)
 
 inline unsigned int hash3D(int x, int y, int z) {
     unsigned int h = static_cast<unsigned int>(x) * 1619u +
@@ -54,8 +57,22 @@ static inline glm::vec3 randomPointInCell(const glm::ivec3& cell) {
 }
 
 
+Noise::Noise() {
+    // perlin lattice points run one past the period, and one more for a wrapped coordinate that
+    // rounded up to it. worley neighbours run one either side
+    for (int c = 0; c < PERLIN_SIDE; c++)
+        for (int b = 0; b < PERLIN_SIDE; b++)
+            for (int a = 0; a < PERLIN_SIDE; a++)
+                m_gradients[a + PERLIN_SIDE * (b + PERLIN_SIDE * c)] = randomVec(glm::vec3(a % PERLIN_PERIOD, b % PERLIN_PERIOD, c % PERLIN_PERIOD));
+    for (int c = 0; c < WORLEY_SIDE; c++)
+        for (int b = 0; b < WORLEY_SIDE; b++)
+            for (int a = 0; a < WORLEY_SIDE; a++)
+                m_points[a + WORLEY_SIDE * (b + WORLEY_SIDE * c)] = randomPointInCell(glm::ivec3(
+                    (a + WORLEY_PERIOD - 1) % WORLEY_PERIOD, (b + WORLEY_PERIOD - 1) % WORLEY_PERIOD, (c + WORLEY_PERIOD - 1) % WORLEY_PERIOD));
+}
+
 float Noise::applyPerlin(glm::vec3 p) {
-    float period = 7.f;
+    float period = PERLIN_PERIOD;
     glm::vec3 wrapped = glm::mod(p, glm::vec3(period));
     glm::vec3 i = glm::floor(wrapped);
     glm::vec3 f = wrapped - i;
@@ -63,13 +80,13 @@ float Noise::applyPerlin(glm::vec3 p) {
     // smoothing fade
     glm::vec3 u = f * f * f * (f * (f * 6.0f - 15.0f) + 10.0f);
 
+    glm::ivec3 base = glm::ivec3(i);
     float result = 0.0f;
     for (int z = 0; z <= 1; z++)
         for (int y = 0; y <= 1; y++)
             for (int x = 0; x <= 1; x++) {
                 glm::vec3 offset(x, y, z);
-                glm::vec3 lattice = glm::mod(i + offset, glm::vec3(period));
-                glm::vec3 g = randomVec(lattice);
+                glm::vec3 g = m_gradients[(base.x + x) + PERLIN_SIDE * ((base.y + y) + PERLIN_SIDE * (base.z + z))];
                 glm::vec3 d = f - offset;
                 float w = (x ? u.x : 1.0f - u.x) *
                           (y ? u.y : 1.0f - u.y) *
@@ -83,15 +100,15 @@ float Noise::applyPerlin(glm::vec3 p) {
 
 float Noise::applyWorley(glm::vec3 p) {
     glm::vec3 cell = glm::floor(p);
-    float period = 5.f;
+    float period = WORLEY_PERIOD;
     float minDist = 1.0f;
 
     for(int z = -1; z <= 1; z++)
         for(int y = -1; y <= 1; y++)
             for(int x = -1; x <= 1; x++) {
                 glm::vec3 neighbor = cell + glm::vec3(x, y, z);
-                glm::vec3 wrappedNeighbor = glm::mod(neighbor, glm::vec3(period));
-                glm::vec3 point = neighbor + randomPointInCell(wrappedNeighbor);
+                glm::ivec3 wrappedNeighbor = glm::ivec3(glm::mod(neighbor, glm::vec3(period))) + 1;
+                glm::vec3 point = neighbor + m_points[wrappedNeighbor.x + WORLEY_SIDE * (wrappedNeighbor.y + WORLEY_SIDE * wrappedNeighbor.z)];
                 glm::vec3 diff = point - p;
                 diff = glm::mod(diff + period * 0.5f, glm::vec3(period)) - period * 0.5f;
                 float dist = glm::length(diff);
@@ -110,3 +127,113 @@ float Noise::applyPerlinWorley(glm::vec3 p) {
     float cloud = perlin * (0.3f + 0.7f * worleyInv);
     return glm::clamp(cloud, 0.0f, 1.0f);
 }
+
+// the batches below repeat the single point calls operation for operation, one lane per point.
+// the tail of a batch repeats the last point rather than running short, so every loop has a
+// fixed trip count
+
+static inline float Wrap(float x, float period) {
+    return x - period * FastMath::floor(x / period);
+}
+
+void Noise::applyPerlin(const glm::vec3* p, float* out, int count) {
+    const float period = PERLIN_PERIOD;
+    for (int start = 0; start < count; start += NOISE_BATCH) {
+        float fx[NOISE_BATCH], fy[NOISE_BATCH], fz[NOISE_BATCH];
+        float ux[NOISE_BATCH], uy[NOISE_BATCH], uz[NOISE_BATCH];
+        int base[NOISE_BATCH];
+        for (int k = 0; k < NOISE_BATCH; k++) {
+            const glm::vec3& q = p[std::min(start + k, count - 1)];
+            float wx = Wrap(q.x, period);
+            float wy = Wrap(q.y, period);
+            float wz = Wrap(q.z, period);
+            int ix = (int)wx;
+            int iy = (int)wy;
+            int iz = (int)wz;
+            fx[k] = wx - (float)ix;
+            fy[k] = wy - (float)iy;
+            fz[k] = wz - (float)iz;
+            ux[k] = fx[k] * fx[k] * fx[k] * (fx[k] * (fx[k] * 6.0f - 15.0f) + 10.0f);
+            uy[k] = fy[k] * fy[k] * fy[k] * (fy[k] * (fy[k] * 6.0f - 15.0f) + 10.0f);
+            uz[k] = fz[k] * fz[k] * fz[k] * (fz[k] * (fz[k] * 6.0f - 15.0f) + 10.0f);
+            base[k] = ix + PERLIN_SIDE * (iy + PERLIN_SIDE * iz);
+        }
+
+        float result[NOISE_BATCH] = {};
+        for (int z = 0; z <= 1; z++)
+            for (int y = 0; y <= 1; y++)
+                for (int x = 0; x <= 1; x++) {
+                    int offset = x + PERLIN_SIDE * (y + PERLIN_SIDE * z);
+                    for (int k = 0; k < NOISE_BATCH; k++) {
+                        const glm::vec3& g = m_gradients[base[k] + offset];
+                        float w = (x ? ux[k] : 1.0f - ux[k]) *
+                                  (y ? uy[k] : 1.0f - uy[k]) *
+                                  (z ? uz[k] : 1.0f - uz[k]);
+                        result[k] += w * (g.x * (fx[k] - x) + g.y * (fy[k] - y) + g.z * (fz[k] - z));
+                    }
+                }
+
+        for (int k = 0; k < NOISE_BATCH && start + k < count; k++) {
+            out[start + k] = glm::clamp((result[k] + 1.0f) * 0.5f, 0.0f, 1.0f);
+        }
+    }
+}
+
+void Noise::applyWorley(const glm::vec3* p, float* out, int count) {
+    const float period = WORLEY_PERIOD;
+    for (int start = 0; start < count; start += NOISE_BATCH) {
+        float px[NOISE_BATCH], py[NOISE_BATCH], pz[NOISE_BATCH];
+        float cx[NOISE_BATCH], cy[NOISE_BATCH], cz[NOISE_BATCH];
+        int base[NOISE_BATCH];
+        for (int k = 0; k < NOISE_BATCH; k++) {
+            const glm::vec3& q = p[std::min(start + k, count - 1)];
+            px[k] = q.x;
+            py[k] = q.y;
+            pz[k] = q.z;
+            cx[k] = FastMath::floor(q.x);
+            cy[k] = FastMath::floor(q.y);
+            cz[k] = FastMath::floor(q.z);
+            base[k] = ((int)Wrap(cx[k], period) + 1) + WORLEY_SIDE * (((int)Wrap(cy[k], period) + 1) + WORLEY_SIDE * ((int)Wrap(cz[k], period) + 1));
+        }
+
+        float minDist[NOISE_BATCH];
+        for (int k = 0; k < NOISE_BATCH; k++) minDist[k] = 1.0f;
+        for (int z = -1; z <= 1; z++)
+            for (int y = -1; y <= 1; y++)
+                for (int x = -1; x <= 1; x++) {
+                    int offset = x + WORLEY_SIDE * (y + WORLEY_SIDE * z);
+                    for (int k = 0; k < NOISE_BATCH; k++) {
+                        const glm::vec3& point = m_points[base[k] + offset];
+                        float dx = Wrap(((cx[k] + x) + point.x - px[k]) + period * 0.5f, period) - period * 0.5f;
+                        float dy = Wrap(((cy[k] + y) + point.y - py[k]) + period * 0.5f, period) - period * 0.5f;
+                        float dz = Wrap(((cz[k] + z) + point.z - pz[k]) + period * 0.5f, period) - period * 0.5f;
+                        float dist = std::sqrt(dx * dx + dy * dy + dz * dz);
+                        minDist[k] = std::min(minDist[k], dist);
+                    }
+                }
+
+        // the single point call's abs() is the integer overload, which truncates at every step.
+        // truncating the smallest distance once gives the same
+        for (int k = 0; k < NOISE_BATCH && start + k < count; k++) {
+            out[start + k] = glm::clamp((float)(int)minDist[k] / sqrtf(3) / 2.f, 0.f, 1.f);
+        }
+    }
+}
+
+void Noise::applyPerlinWorley(const glm::vec3* p, float* out, int count) {
+    glm::vec3 scaled[NOISE_BATCH];
+    float perlin[NOISE_BATCH];
+    float worley[NOISE_BATCH];
+    for (int start = 0; start < count; start += NOISE_BATCH) {
+        int n = std::min(NOISE_BATCH, count - start);
+        for (int k = 0; k < n; k++) scaled[k] = p[start + k] * 1.2f;
+        applyPerlin(scaled, perlin, n);
+        for (int k = 0; k < n; k++) scaled[k] = p[start + k] * 1.5f;
+        applyWorley(scaled, worley, n);
+        for (int k = 0; k < n; k++) {
+            float w = glm::smoothstep(0.2f, 0.8f, worley[k]);
+            float cloud = perlin[k] * (0.3f + 0.7f * (1.0f - w));
+            out[start + k] = glm::clamp(cloud, 0.0f, 1.0f);
+        }
+    }
+}
@@ -2,6 +2,10 @@
 
 #include "glm/glm.hpp"
 
+#define PERLIN_PERIOD 7 // lattice cells before perlin noise repeats
+#define WORLEY_PERIOD 5 // cells before worley noise repeats
+#define NOISE_BATCH 8   // points the batched calls evaluate in step
+
 class Noise
 {
 public:
@@ -13,4 +17,13 @@ public:
     float applyPerlin(glm::vec3 p);
     float applyWorley(glm::vec3 p);
     float applyPerlinWorley(glm::vec3 p);
+    // the same noise at count points, NOISE_BATCH at a time with every lane in step so the
+    // arithmetic vectorises. each result matches the single point call exactly
+    void applyPerlin(const glm::vec3* p, float* out, int count);
+    void applyWorley(const glm::vec3* p, float* out, int count);
+    void applyPerlinWorley(const glm::vec3* p, float* out, int count);
+private:
+    // hashed once, with a border of repeats around each period so lookups never wrap
+    glm::vec3 m_gradients[(PERLIN_PERIOD + 2) * (PERLIN_PERIOD + 2) * (PERLIN_PERIOD + 2)];
+    glm::vec3 m_points[(WORLEY_PERIOD + 2) * (WORLEY_PERIOD + 2) * (WORLEY_PERIOD + 2)];
 };
@@ -172,7 +172,9 @@ bool parseCamera(std::vector<std::string> args, Scene& scene) {
         glm::mat4(1.0f),
         f1,
         0.0f,
-        0, 0
+        0, 0,
+        glm::mat4(1.0f),
+        0.0f
     };
     return true;
 }
@@ -404,8 +406,6 @@ bool setMaterial(std::vector<std::string> args, Scene& scene, int& currmat) {
 
 Scene Parser::parse(std::string filepath) {
     Scene sd{};
-    sd.gen = std::mt19937(std::random_device{}());
-    sd.dis = std::uniform_real_distribution<>(0.0, 1.0);
     std::ifstream file = std::ifstream(filepath);
     if (!file.is_open()) {
         WARN("Unable to open file \"%s\"", filepath.c_str());
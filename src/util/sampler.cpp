@@ -0,0 +1,184 @@
+#include "sampler.h"
+#include "util/jlm.h"
+#include "renderer/config.h"
+#include <algorithm>
+#include <cmath>
+
+// direction numbers of the first four sobol dimensions (joe & kuo), higher dimensions are padded
+// by reusing these with a different scramble per group of four
+static const uint32_t g_sobol_directions[4][32] = {
+    {0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u, 0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u, 0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u, 0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u},
+    {0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u, 0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u, 0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u, 0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u, 0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u, 0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u, 0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u, 0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu},
+    {0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u, 0xe8000000u, 0x5c000000u, 0x8e000000u, 0xc5000000u, 0x68800000u, 0x9cc00000u, 0xee600000u, 0x55900000u, 0x80680000u, 0xc09c0000u, 0x60ee0000u, 0x90550000u, 0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u, 0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u, 0x8000e880u, 0xc0005cc0u, 0x60008e60u, 0x9000c590u, 0xe8006868u, 0x5c009c9cu, 0x8e00eeeeu, 0xc5005555u},
+    {0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u, 0xf8000000u, 0x74000000u, 0xa2000000u, 0x93000000u, 0xd8800000u, 0x25400000u, 0x59e00000u, 0xe6d00000u, 0x78080000u, 0xb40c0000u, 0x82020000u, 0xc3050000u, 0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u, 0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u, 0x58800080u, 0xe54000c0u, 0x79e00020u, 0xb6d00050u, 0x800800f8u, 0xc00c0074u, 0x200200a2u, 0x50050093u},
+};
+
+static inline uint32_t sobol(uint32_t index, uint32_t dimension) {
+    uint32_t x = 0;
+    for (int bit = 0; index != 0; bit++, index >>= 1)
+        if (index & 1) x ^= g_sobol_directions[dimension][bit];
+    return x;
+}
+
+static inline uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// laine-karras style hash, only ever flips bits based on lower bits
+static inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+static inline uint32_t hashCombine(uint32_t seed, uint32_t v) {
+    return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+static inline uint32_t hashxy(uint32_t x, uint32_t y) {
+    uint32_t h = x * 0x1f123bb5 ^ y * 0x5f356495;
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    h *= 0x846ca68b;
+    h ^= h >> 16;
+    return h;
+}
+
+float Sampler::sample(uint32_t index, uint32_t dimension, uint32_t seed) {
+    uint32_t group = hashCombine(seed, dimension / 4);
+    uint32_t shuffled = nestedUniformScramble(index, group);
+    uint32_t x = nestedUniformScramble(sobol(shuffled, dimension % 4), hashCombine(group, dimension % 4 + 1));
+    return std::min((x >> 8) * (1.0f / 16777216.0f), 0.99999994f);
+}
+
+void Sampler::start(uint32_t x, uint32_t y, uint32_t index) {
+    m_seed = hashCombine(hashxy(x, y), GlobalConfig::seed());
+    m_index = index;
+    m_dimension = 0;
+    jlm::seed(((uint64_t)y << 32) | x, ((uint64_t)GlobalConfig::seed() << 32) | index);
+}
+
+void Sampler::attach(PrimarySpace* space) {
+    m_primary = space;
+}
+
+SamplerState Sampler::save() const {
+    return { m_seed, m_index, m_dimension, jlm::rng() };
+}
+
+void Sampler::restore(const SamplerState& state) {
+    m_seed = state.seed;
+    m_index = state.index;
+    m_dimension = state.dimension;
+    jlm::rng() = state.rng;
+}
+
+float Sampler::get1D() {
+    if (m_primary) return m_primary->next();
+    if (m_dimension >= SAMPLER_DIMENSIONS) return jlm::random01();
+    return sample(m_index, m_dimension++, m_seed);
+}
+
+glm::vec2 Sampler::get2D() {
+    if (m_primary) {
+        float x = m_primary->next();
+        return glm::vec2(x, m_primary->next());
+    }
+    m_dimension += m_dimension & 1; // pairs never straddle two groups
+    if (m_dimension >= SAMPLER_DIMENSIONS) return glm::vec2(jlm::random01(), jlm::random01());
+    glm::vec2 u = glm::vec2(sample(m_index, m_dimension, m_seed), sample(m_index, m_dimension + 1, m_seed));
+    m_dimension += 2;
+    return u;
+}
+
+uint32_t Sampler::reserve(uint32_t dimensions) {
+    // blocks that fit in one group of four start on a group so they share its shuffle
+    if (dimensions <= 4) m_dimension = (m_dimension + 3) & ~3u;
+    uint32_t first = m_dimension;
+    m_dimension += dimensions;
+    return first;
+}
+
+// sub-samples of one path sample index the sequence in between the neighbouring path samples,
+// so several samples taken at one vertex stay stratified against each other
+float Sampler::get1D(uint32_t dimension, uint32_t sub, uint32_t count) const {
+    // sub-samples stay out of primary sample space, the chain sees their average as part of the path
+    if (m_primary || dimension >= SAMPLER_DIMENSIONS) return jlm::random01();
+    return sample(m_index * count + sub, dimension, m_seed);
+}
+
+glm::vec2 Sampler::get2D(uint32_t dimension, uint32_t sub, uint32_t count) const {
+    if (m_primary || dimension + 1 >= SAMPLER_DIMENSIONS) return glm::vec2(jlm::random01(), jlm::random01());
+    uint32_t index = m_index * count + sub;
+    return glm::vec2(sample(index, dimension, m_seed), sample(index, dimension + 1, m_seed));
+}
+
+PrimarySpace::PrimarySpace(uint64_t seed, float sigma, float largeStep) : m_sigma(sigma), m_largeStepProbability(largeStep) {
+    m_rng.state = 0u;
+    m_rng.inc = (seed << 1u) | 1u;
+    m_rng.next();
+    m_rng.state += 0x853c49e6748fea9bULL;
+    m_rng.next();
+}
+
+void PrimarySpace::startIteration() {
+    // the very first iteration is always a large step, so a chain starts from a fresh path
+    m_iteration++;
+    m_largeStep = m_iteration == 1 || (m_rng.next() >> 8) * (1.0f / 16777216.0f) < m_largeStepProbability;
+    m_next = 0;
+}
+
+void PrimarySpace::accept() {
+    if (m_largeStep) m_lastLargeStep = m_iteration;
+}
+
+void PrimarySpace::reject() {
+    for (PrimarySample& s : m_samples) {
+        if (s.modified != m_iteration) continue;
+        s.value = s.backup;
+        s.modified = s.backupModified;
+    }
+    m_iteration--;
+}
+
+float PrimarySpace::next() {
+    mutate(m_next);
+    return m_samples[m_next++].value;
+}
+
+void PrimarySpace::mutate(size_t index) {
+    if (index >= m_samples.size()) m_samples.resize(index + 1);
+    PrimarySample& s = m_samples[index];
+    auto uniform = [this]() { return (m_rng.next() >> 8) * (1.0f / 16777216.0f); };
+
+    // a coordinate untouched since the last accepted large step would have been replaced by it
+    if (s.modified < m_lastLargeStep) {
+        s.value = uniform();
+        s.modified = m_lastLargeStep;
+    }
+    if (s.modified == m_iteration) return;
+    s.backup = s.value;
+    s.backupModified = s.modified;
+    if (m_largeStep) {
+        s.value = uniform();
+    } else {
+        // gaussian perturbation, widened for every small step the coordinate sat out, wrapped into [0, 1)
+        float u1 = std::max(uniform(), 1e-7f);
+        float u2 = uniform();
+        float normal = std::sqrt(-2.0f * std::log(u1)) * std::cos(2.0f * M_PI * u2);
+        float sigma = m_sigma * std::sqrt((float)(m_iteration - s.modified));
+        s.value += normal * sigma;
+        s.value -= std::floor(s.value);
+        s.value = std::min(s.value, 0.99999994f);
+    }
+    s.modified = m_iteration;
+}
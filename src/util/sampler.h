@@ -0,0 +1,78 @@
+#pragma once
+
+#include "util/jlm.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// deep paths gain little from stratification, past this they draw from the pixel's pcg stream
+#define SAMPLER_DIMENSIONS 64
+
+class PrimarySpace;
+
+// where a path is in its sequence, so paths traced a stage at a time pick up where they left off
+struct SamplerState {
+    uint32_t seed = 0;
+    uint32_t index = 0;
+    uint32_t dimension = 0;
+    jlm::PCG32 rng;
+};
+
+// Owen-scrambled Sobol sampler. Samples are a pure function of the pixel, the sample index
+// and the dimension, so nothing is allocated or shared between threads. Each path consumes
+// dimensions in order through get1D/get2D, starting again from zero with every start() call.
+// start() also seeds jlm::random01 for the calling thread.
+class Sampler {
+public:
+    static Sampler& get() {
+        static thread_local Sampler instance;
+        return instance;
+    }
+    void start(uint32_t x, uint32_t y, uint32_t index);
+    void attach(PrimarySpace* space);
+    SamplerState save() const;
+    void restore(const SamplerState& state);
+    float get1D();
+    glm::vec2 get2D();
+    uint32_t reserve(uint32_t dimensions);
+    float get1D(uint32_t dimension, uint32_t sub, uint32_t count) const;
+    glm::vec2 get2D(uint32_t dimension, uint32_t sub, uint32_t count) const;
+public:
+    static float sample(uint32_t index, uint32_t dimension, uint32_t seed);
+private:
+    uint32_t m_seed = 0;
+    uint32_t m_index = 0;
+    uint32_t m_dimension = 0;
+    PrimarySpace* m_primary = nullptr;
+};
+
+// one markov chain's point in primary sample space, after Kelemen et al. While attached to the
+// sampler every sequential draw reads the next coordinate instead, and each coordinate is only
+// mutated once a path actually reaches it, by as much as all the small steps it missed
+struct PrimarySample {
+    float value = 0.0f;
+    float backup = 0.0f;
+    int64_t modified = 0;
+    int64_t backupModified = 0;
+};
+
+class PrimarySpace {
+public:
+    PrimarySpace(uint64_t seed, float sigma, float largeStep);
+    void startIteration();
+    void accept();
+    void reject();
+    float next();
+    bool largeStep() const { return m_largeStep; }
+private:
+    void mutate(size_t index);
+private:
+    jlm::PCG32 m_rng;
+    std::vector<PrimarySample> m_samples;
+    float m_sigma;
+    float m_largeStepProbability;
+    bool m_largeStep = true;
+    int64_t m_iteration = 0;
+    int64_t m_lastLargeStep = 0;
+    size_t m_next = 0;
+};